@@ -0,0 +1,256 @@
+/* Minimal BoringSSL glue for the benchmark: the boring_* functions of boringssl.patch
+   over an in-memory SSL, ex_data and error queue */
+
+#include "glue.h"
+
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+
+static const SSL_CIPHER glue_ciphers[] =
+{
+    { "TLS_GOSTR341001_WITH_28147_CNT_IMIT", 0x0081 },
+    { "TLS_GOSTR341112_256_WITH_28147_CNT_IMIT", 0xFF85 },
+    { "TLS_GOSTR341112_256_WITH_KUZNYECHIK_MGM_L", 0xC103 },
+    { "TLS_GOSTR341112_256_WITH_MAGMA_MGM_L", 0xC104 },
+    { "TLS_GOSTR341112_256_WITH_KUZNYECHIK_MGM_S", 0xC105 },
+    { "TLS_GOSTR341112_256_WITH_MAGMA_MGM_S", 0xC106 },
+    { "TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256", 0xC02F },
+    { "TLS_AES_128_GCM_SHA256", 0x1301 },
+};
+
+static std::atomic<int> glue_ex_next( 0 );
+static thread_local std::vector<int> glue_errors;
+static std::atomic< void ( * )( SSL *, const char **, const int *, size_t ) > glue_verify_cb( nullptr );
+
+int boring_BIO_read( SSL * s, void * data, int len )
+{
+    GLUE_PIPE * p = s->rbio;
+    size_t n = p->data.size() - p->pos;
+
+    if( p->capacity )
+    {
+        if( !p->buffered )
+        {
+            if( !n )
+                return -1;
+
+            p->buffered = n < p->capacity ? n : p->capacity;
+            p->socket_reads++;
+        }
+
+        n = p->buffered;
+    }
+
+    if( !n )
+        return -1;
+
+    if( n > (size_t)len )
+        n = (size_t)len;
+
+    if( p->capacity )
+        p->buffered -= n;
+
+    memcpy( data, p->data.data() + p->pos, n );
+    p->pos += n;
+
+    if( p->pos == p->data.size() )
+    {
+        p->data.clear();
+        p->pos = 0;
+    }
+
+    return (int)n;
+}
+
+int boring_BIO_write( SSL * s, const void * data, int len )
+{
+    s->wbio->data.append( (const char *)data, (size_t)len );
+    return len;
+}
+
+void boring_ERR_clear_error( void )
+{
+    glue_errors.clear();
+}
+
+void boring_ERR_put_error( int /* lib */, int /* unused */, int reason, const char * /* file */, unsigned /* line */ )
+{
+    glue_errors.push_back( reason );
+}
+
+const SSL_CIPHER * boring_SSL_get_cipher_by_value( uint16_t value )
+{
+    for( size_t i = 0; i < sizeof( glue_ciphers ) / sizeof( glue_ciphers[0] ); i++ )
+        if( glue_ciphers[i].id == value )
+            return &glue_ciphers[i];
+
+    return nullptr;
+}
+
+int boring_SSL_get_ex_new_index( void )
+{
+    return glue_ex_next++;
+}
+
+int boring_SSL_set_ex_data( SSL * s, int idx, void * data )
+{
+    if( idx < 0 )
+        return 0;
+
+    if( s->ex_data.size() <= (size_t)idx )
+        s->ex_data.resize( (size_t)idx + 1, nullptr );
+
+    s->ex_data[idx] = data;
+    return 1;
+}
+
+void * boring_SSL_get_ex_data( const SSL * s, int idx )
+{
+    if( idx < 0 || s->ex_data.size() <= (size_t)idx )
+        return nullptr;
+
+    return s->ex_data[idx];
+}
+
+// GOST-capable bit, decided once per connection by gostssl_cachestring
+bool glue_ssl_is_gost( const SSL * s )
+{
+    return s->is_gost;
+}
+
+char boring_set_gost_cb( SSL * s, char is_gost )
+{
+    s->is_gost = is_gost != 0;
+    return 1;
+}
+
+char boring_set_ca_names_cb( SSL * s, const char ** bufs, int * lens, size_t count )
+{
+    std::unique_ptr< std::vector<std::string> > names( new std::vector<std::string>() );
+
+    for( size_t i = 0; i < count; i++ )
+        names->push_back( std::string( bufs[i], (size_t)lens[i] ) );
+
+    s->s3->hs->ca_names = std::move( names );
+    return 1;
+}
+
+// the certificate verifier always succeeds synchronously here
+int boring_set_connected_cb( SSL * s, const char * /* alpn */, size_t /* alpn_len */,
+                             uint16_t version, uint16_t cipher_id,
+                             const char ** cert_bufs, int * cert_lens,
+                             size_t cert_count )
+{
+    if( !s->established )
+    {
+        const SSL_CIPHER * cipher = boring_SSL_get_cipher_by_value( cipher_id );
+
+        if( !cipher || !cert_count )
+            return 0;
+
+        s->version = version;
+        s->cipher = cipher;
+        s->established = true;
+
+        void ( * verify_cb )( SSL *, const char **, const int *, size_t ) = glue_verify_cb.load();
+        if( verify_cb )
+            verify_cb( s, cert_bufs, cert_lens, cert_count );
+    }
+
+    return 1;
+}
+
+void glue_set_verify_cb( void ( * cb )( SSL * s, const char ** certs, const int * lens, size_t count ) )
+{
+    glue_verify_cb.store( cb );
+}
+
+static std::once_flag gostssl_once;
+static char is_gostssl = 0;
+
+static void gostssl_init_once()
+{
+    if( gostssl_init() )
+        is_gostssl = 1;
+}
+
+char gostssl()
+{
+    std::call_once( gostssl_once, gostssl_init_once );
+    return is_gostssl;
+}
+
+SSL * glue_ssl_new( const char * hostname, GLUE_PIPE * rbio, GLUE_PIPE * wbio )
+{
+    SSL * s = new SSL();
+
+    if( hostname )
+    {
+        size_t len = strlen( hostname ) + 1;
+        s->hostname.reset( new char[len] );
+        memcpy( s->hostname.get(), hostname, len );
+    }
+
+    s->config.reset( new SSL_CONFIG() );
+    s->config->alpn_client_proto_list.assign( (const uint8_t *)"\x02h2\x08http/1.1", (const uint8_t *)"\x02h2\x08http/1.1" + 12 );
+    s->s3.reset( new SSL3_STATE() );
+    s->s3->hs.reset( new SSL_HANDSHAKE() );
+    s->rbio = rbio;
+    s->wbio = wbio;
+    s->is_gost = false;
+    return s;
+}
+
+void glue_ssl_free( SSL * s )
+{
+    if( s && glue_ssl_is_gost( s ) )
+        gostssl_free( s );
+
+    delete s;
+}
+
+int glue_ssl_do_handshake( SSL * s )
+{
+    if( glue_ssl_is_gost( s ) )
+    {
+        int is_gost;
+        int ret_gost = gostssl_connect( s, &is_gost );
+        if( is_gost )
+            return ret_gost;
+    }
+
+    return 0;
+}
+
+int glue_ssl_read( SSL * s, void * buf, int len )
+{
+    if( glue_ssl_is_gost( s ) )
+    {
+        int is_gost;
+        int ret_gost = gostssl_read( s, buf, len, &is_gost );
+        if( is_gost )
+            return ret_gost;
+    }
+
+    return 0;
+}
+
+int glue_ssl_write( SSL * s, const void * buf, int len )
+{
+    if( glue_ssl_is_gost( s ) )
+    {
+        int is_gost;
+        int ret_gost = gostssl_write( s, buf, len, &is_gost );
+        if( is_gost )
+            return ret_gost;
+    }
+
+    return 0;
+}
+
+int glue_err_last()
+{
+    return glue_errors.empty() ? 0 : glue_errors.back();
+}
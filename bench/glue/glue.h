@@ -0,0 +1,37 @@
+/* Benchmark side of the BoringSSL glue: SSL objects over loopback pipes and
+   the entry points routed the way boringssl.patch routes them */
+
+#ifndef GOSTSSL_BENCH_GLUE_H
+#define GOSTSSL_BENCH_GLUE_H
+
+#include <../ssl/internal.h>
+
+SSL * glue_ssl_new( const char * hostname, GLUE_PIPE * rbio, GLUE_PIPE * wbio );
+void glue_ssl_free( SSL * s ); // SSL_free
+bool glue_ssl_is_gost( const SSL * s ); // ssl_is_gost
+
+// gostssl_* when the GOST bit is set, 0 otherwise (stock BoringSSL is not part of the benchmark)
+int glue_ssl_do_handshake( SSL * s );
+int glue_ssl_read( SSL * s, void * buf, int len );
+int glue_ssl_write( SSL * s, const void * buf, int len );
+
+// last reason code queued by boring_ERR_put_error on this thread, 0: none
+int glue_err_last();
+
+// Chromium's CertVerifier, run by boring_set_connected_cb on the peer chain, NULL: none
+void glue_set_verify_cb( void ( * cb )( SSL * s, const char ** certs, const int * lens, size_t count ) );
+
+// gostssl.cpp entry points called from Chromium
+extern "C" {
+void gostssl_cachestring( SSL * s, void * cachestring, size_t len );
+int gostssl_get_stats( const char ** names, uint64_t * values, int count );
+void gostssl_set_histogram_cb( void ( * cb )( const char * name, uint64_t sample, int is_count ) );
+void gostssl_certhook( void * s, void * cert, int size );
+void gostssl_verifychainhook( const char * host, const char ** certs, const int * lens, size_t count, unsigned * gost_status );
+void gostssl_clientcertshook( char *** certs, int ** lens, wchar_t *** names, int * count, int * is_gost );
+void gostssl_certdbchangedhook();
+void gostssl_warmuphook();
+void gostssl_datadirhook( void * cachestring, size_t len, const char * dir );
+}
+
+#endif // GOSTSSL_BENCH_GLUE_H
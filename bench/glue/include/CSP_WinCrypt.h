@@ -0,0 +1,179 @@
+/* Benchmark stand-in for the CryptoPro CSP SDK: only the CAPI subset gostssl.cpp uses,
+   the functions are implemented by mock/capi.cpp and loaded through CAPI10_LIB / CAPI20_LIB */
+
+#ifndef CSP_WINCRYPT_H
+#define CSP_WINCRYPT_H
+
+#include "CSP_WinDef.h"
+
+typedef uintptr_t HCRYPTPROV;
+typedef uintptr_t HCRYPTKEY;
+typedef uintptr_t HCRYPTHASH;
+typedef void * HCERTSTORE;
+typedef void * HCERTCHAINENGINE;
+
+typedef struct _CRYPT_ALGORITHM_IDENTIFIER
+{
+    LPSTR pszObjId;
+}
+CRYPT_ALGORITHM_IDENTIFIER;
+
+typedef struct _CERT_PUBLIC_KEY_INFO
+{
+    CRYPT_ALGORITHM_IDENTIFIER Algorithm;
+}
+CERT_PUBLIC_KEY_INFO;
+
+typedef struct _CERT_INFO
+{
+    CRYPT_ALGORITHM_IDENTIFIER SignatureAlgorithm;
+    FILETIME NotBefore;
+    FILETIME NotAfter;
+    CERT_PUBLIC_KEY_INFO SubjectPublicKeyInfo;
+}
+CERT_INFO, * PCERT_INFO;
+
+typedef struct _CERT_CONTEXT
+{
+    DWORD dwCertEncodingType;
+    BYTE * pbCertEncoded;
+    DWORD cbCertEncoded;
+    PCERT_INFO pCertInfo;
+    HCERTSTORE hCertStore;
+}
+CERT_CONTEXT;
+typedef const CERT_CONTEXT * PCCERT_CONTEXT;
+
+typedef struct _CERT_TRUST_STATUS
+{
+    DWORD dwErrorStatus;
+    DWORD dwInfoStatus;
+}
+CERT_TRUST_STATUS;
+
+typedef struct _CERT_CHAIN_CONTEXT
+{
+    DWORD cbSize;
+    CERT_TRUST_STATUS TrustStatus;
+}
+CERT_CHAIN_CONTEXT;
+typedef const CERT_CHAIN_CONTEXT * PCCERT_CHAIN_CONTEXT;
+
+typedef struct _CERT_USAGE_MATCH
+{
+    DWORD dwType;
+    struct
+    {
+        DWORD cUsageIdentifier;
+        LPSTR * rgpszUsageIdentifier;
+    }
+    Usage;
+}
+CERT_USAGE_MATCH;
+
+typedef struct _CERT_CHAIN_PARA
+{
+    DWORD cbSize;
+    CERT_USAGE_MATCH RequestedUsage;
+}
+CERT_CHAIN_PARA, * PCERT_CHAIN_PARA;
+
+typedef struct _CERT_CHAIN_POLICY_PARA
+{
+    DWORD cbSize;
+    DWORD dwFlags;
+    void * pvExtraPolicyPara;
+}
+CERT_CHAIN_POLICY_PARA, * PCERT_CHAIN_POLICY_PARA;
+
+typedef struct _CERT_CHAIN_POLICY_STATUS
+{
+    DWORD cbSize;
+    DWORD dwError;
+    LONG lChainIndex;
+    LONG lElementIndex;
+    void * pvExtraPolicyStatus;
+}
+CERT_CHAIN_POLICY_STATUS, * PCERT_CHAIN_POLICY_STATUS;
+
+typedef struct _SSL_EXTRA_CERT_CHAIN_POLICY_PARA
+{
+    DWORD cbSize;
+    DWORD dwAuthType;
+    DWORD fdwChecks;
+    wchar_t * pwszServerName;
+}
+SSL_EXTRA_CERT_CHAIN_POLICY_PARA;
+
+#define X509_ASN_ENCODING 0x00000001
+#define PKCS_7_ASN_ENCODING 0x00010000
+
+#define PROV_GOST_2001_DH 75
+#define PROV_GOST_2012_256 80
+#define CRYPT_VERIFYCONTEXT 0xF0000000
+#define CRYPT_SILENT 0x00000040
+
+#define CERT_STORE_PROV_MEMORY ( (LPCSTR)2 )
+#define CERT_STORE_PROV_SYSTEM_A ( (LPCSTR)9 )
+#define CERT_STORE_CREATE_NEW_FLAG 0x00002000
+#define CERT_STORE_OPEN_EXISTING_FLAG 0x00004000
+#define CERT_STORE_READONLY_FLAG 0x00008000
+#define CERT_STORE_ADD_USE_EXISTING 2
+#define CERT_STORE_ADD_ALWAYS 4
+
+#define CERT_FIND_ANY 0
+#define CERT_DIGITAL_SIGNATURE_KEY_USAGE 0x80
+#define CERT_KEY_PROV_INFO_PROP_ID 2
+#define CERT_NAME_SIMPLE_DISPLAY_TYPE 4
+#define CERT_NAME_ISSUER_FLAG 0x1
+
+#define CERT_E_CRITICAL ( (LONG)0x800B0105L )
+#define CERT_CHAIN_POLICY_SSL ( (LPCSTR)4 )
+#define CERT_CHAIN_REVOCATION_CHECK_CHAIN_EXCLUDE_ROOT 0x40000000
+#define AUTHTYPE_SERVER 2
+#define USAGE_MATCH_TYPE_AND 0
+
+#define szOID_PKIX_KP_SERVER_AUTH "1.3.6.1.5.5.7.3.1"
+
+#define CryptAcquireContext CryptAcquireContextA
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+BOOL WINAPI CryptAcquireContextA( HCRYPTPROV * phProv, LPCSTR szContainer, LPCSTR szProvider, DWORD dwProvType, DWORD dwFlags );
+BOOL WINAPI CryptAcquireContextW( HCRYPTPROV * phProv, LPCWSTR szContainer, LPCWSTR szProvider, DWORD dwProvType, DWORD dwFlags );
+BOOL WINAPI CryptReleaseContext( HCRYPTPROV hProv, DWORD dwFlags );
+BOOL WINAPI CryptSetProvParam( HCRYPTPROV hProv, DWORD dwParam, const BYTE * pbData, DWORD dwFlags );
+BOOL WINAPI CryptGetUserKey( HCRYPTPROV hProv, DWORD dwKeySpec, HCRYPTKEY * phUserKey );
+BOOL WINAPI CryptExportKey( HCRYPTKEY hKey, HCRYPTKEY hExpKey, DWORD dwBlobType, DWORD dwFlags, BYTE * pbData, DWORD * pdwDataLen );
+BOOL WINAPI CryptImportKey( HCRYPTPROV hProv, const BYTE * pbData, DWORD dwDataLen, HCRYPTKEY hPubKey, DWORD dwFlags, HCRYPTKEY * phKey );
+BOOL WINAPI CryptSetKeyParam( HCRYPTKEY hKey, DWORD dwParam, const BYTE * pbData, DWORD dwFlags );
+BOOL WINAPI CryptEncrypt( HCRYPTKEY hKey, HCRYPTHASH hHash, BOOL Final, DWORD dwFlags, BYTE * pbData, DWORD * pdwDataLen, DWORD dwBufLen );
+BOOL WINAPI CryptDestroyKey( HCRYPTKEY hKey );
+BOOL WINAPI CryptGenRandom( HCRYPTPROV hProv, DWORD dwLen, BYTE * pbBuffer );
+BOOL WINAPI CryptBinaryToStringA( const BYTE * pbBinary, DWORD cbBinary, DWORD dwFlags, LPSTR pszString, DWORD * pcchString );
+BOOL WINAPI CryptStringToBinaryA( LPCSTR pszString, DWORD cchString, DWORD dwFlags, BYTE * pbBinary, DWORD * pcbBinary, DWORD * pdwSkip, DWORD * pdwFlags );
+
+PCCERT_CONTEXT WINAPI CertCreateCertificateContext( DWORD dwCertEncodingType, const BYTE * pbCertEncoded, DWORD cbCertEncoded );
+BOOL WINAPI CertFreeCertificateContext( PCCERT_CONTEXT pCertContext );
+PCCERT_CONTEXT WINAPI CertDuplicateCertificateContext( PCCERT_CONTEXT pCertContext );
+HCERTSTORE WINAPI CertOpenStore( LPCSTR lpszStoreProvider, DWORD dwEncodingType, HCRYPTPROV hCryptProv, DWORD dwFlags, const void * pvPara );
+BOOL WINAPI CertCloseStore( HCERTSTORE hCertStore, DWORD dwFlags );
+PCCERT_CONTEXT WINAPI CertFindCertificateInStore( HCERTSTORE hCertStore, DWORD dwCertEncodingType, DWORD dwFindFlags, DWORD dwFindType, const void * pvFindPara, PCCERT_CONTEXT pPrevCertContext );
+BOOL WINAPI CertAddEncodedCertificateToStore( HCERTSTORE hCertStore, DWORD dwCertEncodingType, const BYTE * pbCertEncoded, DWORD cbCertEncoded, DWORD dwAddDisposition, PCCERT_CONTEXT * ppCertContext );
+PCCERT_CONTEXT WINAPI CertGetIssuerCertificateFromStore( HCERTSTORE hCertStore, PCCERT_CONTEXT pSubjectContext, PCCERT_CONTEXT pPrevIssuerContext, DWORD * pdwFlags );
+BOOL WINAPI CertGetCertificateContextProperty( PCCERT_CONTEXT pCertContext, DWORD dwPropId, void * pvData, DWORD * pcbData );
+BOOL WINAPI CertSetCertificateContextProperty( PCCERT_CONTEXT pCertContext, DWORD dwPropId, DWORD dwFlags, const void * pvData );
+BOOL WINAPI CertGetIntendedKeyUsage( DWORD dwCertEncodingType, PCERT_INFO pCertInfo, BYTE * pbKeyUsage, DWORD cbKeyUsage );
+DWORD WINAPI CertGetNameStringW( PCCERT_CONTEXT pCertContext, DWORD dwType, DWORD dwFlags, void * pvTypePara, LPWSTR pszNameString, DWORD cchNameString );
+LONG WINAPI CertVerifyTimeValidity( LPFILETIME pTimeToVerify, PCERT_INFO pCertInfo );
+BOOL WINAPI CertGetCertificateChain( HCERTCHAINENGINE hChainEngine, PCCERT_CONTEXT pCertContext, LPFILETIME pTime, HCERTSTORE hAdditionalStore, PCERT_CHAIN_PARA pChainPara, DWORD dwFlags, LPVOID pvReserved, PCCERT_CHAIN_CONTEXT * ppChainContext );
+void WINAPI CertFreeCertificateChain( PCCERT_CHAIN_CONTEXT pChainContext );
+BOOL WINAPI CertVerifyCertificateChainPolicy( LPCSTR pszPolicyOID, PCCERT_CHAIN_CONTEXT pChainContext, PCERT_CHAIN_POLICY_PARA pPolicyPara, PCERT_CHAIN_POLICY_STATUS pPolicyStatus );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CSP_WINCRYPT_H
@@ -0,0 +1,37 @@
+/* Benchmark stand-in for the CryptoPro CSP SDK: Windows base types used by gostssl.cpp */
+
+#ifndef CSP_WINDEF_H
+#define CSP_WINDEF_H
+
+#include <stdint.h>
+#include <wchar.h>
+
+typedef unsigned char BYTE;
+typedef uint32_t DWORD;
+typedef int BOOL;
+typedef int32_t LONG;
+typedef char * LPSTR;
+typedef const char * LPCSTR;
+typedef wchar_t * LPWSTR;
+typedef const wchar_t * LPCWSTR;
+typedef void * LPVOID;
+typedef void * HANDLE;
+typedef uintptr_t UINT_PTR;
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#define WINAPI
+
+typedef struct _FILETIME
+{
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+}
+FILETIME, * LPFILETIME;
+
+#endif // CSP_WINDEF_H
@@ -0,0 +1,13 @@
+/* Benchmark stand-in for the CryptoPro CSP SDK: GOST object identifiers */
+
+#ifndef WINCRYPTEX_H
+#define WINCRYPTEX_H
+
+#define szOID_CP_GOST_R3411_R3410EL "1.2.643.2.2.3"
+#define szOID_CP_GOST_R3411_12_256_R3410 "1.2.643.7.1.1.3.2"
+#define szOID_CP_GOST_R3411_12_512_R3410 "1.2.643.7.1.1.3.3"
+#define szOID_CP_GOST_R3410EL "1.2.643.2.2.19"
+#define szOID_CP_GOST_R3410_12_256 "1.2.643.7.1.1.1.1"
+#define szOID_CP_GOST_R3410_12_512 "1.2.643.7.1.1.1.2"
+
+#endif // WINCRYPTEX_H
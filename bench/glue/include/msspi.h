@@ -0,0 +1,64 @@
+/* Benchmark stand-in for msspi.h: the msspi interface gostssl.cpp uses, implemented by mock/msspi.cpp */
+
+#ifndef MSSPI_H
+#define MSSPI_H
+
+#include <stddef.h>
+
+#include "CSP_WinDef.h"
+
+typedef struct MSSPI * MSSPI_HANDLE;
+
+typedef int ( * msspi_read_cb )( void * cb_arg, void * buf, int len );
+typedef int ( * msspi_write_cb )( void * cb_arg, const void * buf, int len );
+typedef int ( * msspi_cert_cb )( void * cb_arg );
+
+typedef struct _SecPkgContext_CipherInfo
+{
+    DWORD dwVersion;
+    DWORD dwProtocol;
+    DWORD dwCipherSuite;
+}
+SecPkgContext_CipherInfo, * PSecPkgContext_CipherInfo;
+
+#define MSSPI_READING 0x00000001
+#define MSSPI_WRITING 0x00000002
+#define MSSPI_X509_LOOKUP 0x00000004
+#define MSSPI_SENT_SHUTDOWN 0x00000008
+#define MSSPI_RECEIVED_SHUTDOWN 0x00000010
+#define MSSPI_LAST_PROC_WRITE 0x00000020
+#define MSSPI_ERROR 0x00000040
+
+#define MSSPI_VERIFY_OK 0x00000000
+#define MSSPI_VERIFY_ERROR 0xFFFFFFFF
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+MSSPI_HANDLE msspi_open( void * cb_arg, msspi_read_cb, msspi_write_cb );
+void msspi_close( MSSPI_HANDLE h );
+
+char msspi_set_hostname( MSSPI_HANDLE h, const char * hostname );
+char msspi_set_cachestring( MSSPI_HANDLE h, const char * cachestring );
+char msspi_set_alpn( MSSPI_HANDLE h, const unsigned char * alpn, unsigned len );
+char msspi_set_mycert( MSSPI_HANDLE h, const char * clientCert, int len );
+void msspi_set_cert_cb( MSSPI_HANDLE h, msspi_cert_cb );
+
+int msspi_connect( MSSPI_HANDLE h );
+int msspi_read( MSSPI_HANDLE h, void * buf, int len );
+int msspi_peek( MSSPI_HANDLE h, void * buf, int len );
+int msspi_write( MSSPI_HANDLE h, const void * buf, int len );
+int msspi_state( MSSPI_HANDLE h );
+
+const char * msspi_get_alpn( MSSPI_HANDLE h );
+PSecPkgContext_CipherInfo msspi_get_cipherinfo( MSSPI_HANDLE h );
+char msspi_get_peercerts( MSSPI_HANDLE h, const char ** bufs, int * lens, size_t * count );
+char msspi_get_issuerlist( MSSPI_HANDLE h, const char ** bufs, int * lens, size_t * count );
+unsigned msspi_verify( MSSPI_HANDLE h );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MSSPI_H
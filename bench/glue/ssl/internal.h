@@ -0,0 +1,123 @@
+/* Benchmark stand-in for BoringSSL ssl/internal.h (with boringssl.patch applied):
+   only the SSL state gostssl.cpp touches and the boring_* glue, see glue/boring.cpp */
+
+#ifndef GOSTSSL_BENCH_INTERNAL_H
+#define GOSTSSL_BENCH_INTERNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#define SSL3_VERSION 0x0300
+#define TLS1_VERSION 0x0301
+#define TLS1_1_VERSION 0x0302
+#define TLS1_2_VERSION 0x0303
+#define TLS1_3_VERSION 0x0304
+
+#define SSL_NOTHING 1
+#define SSL_WRITING 2
+#define SSL_READING 3
+#define SSL_ERROR_WANT_X509_LOOKUP 4
+#define SSL_ERROR_WANT_CERTIFICATE_VERIFY 16
+
+#define ERR_LIB_SSL 16
+#define ERR_R_INTERNAL_ERROR 68
+#define SSL_R_UNKNOWN_CIPHER_RETURNED 249
+#define SSL_R_TLS_GOST_REQUIRED 3072
+
+struct ssl_st;
+typedef struct ssl_st SSL;
+
+struct SSL_CIPHER
+{
+    const char * name;
+    uint16_t id;
+};
+
+struct CERT
+{
+    int ( * cert_cb )( SSL * ssl, void * arg );
+    void * cert_cb_arg;
+};
+
+struct SSL_CONFIG
+{
+    std::unique_ptr<CERT> cert;
+    std::vector<uint8_t> alpn_client_proto_list;
+};
+
+struct SSL_HANDSHAKE
+{
+    std::unique_ptr< std::vector<std::string> > ca_names;
+    const SSL_CIPHER * new_cipher = nullptr;
+};
+
+struct SSL3_STATE
+{
+    std::unique_ptr<SSL_HANDSHAKE> hs;
+    int rwstate = SSL_NOTHING;
+};
+
+// one direction of an in-memory loopback socket, reads return -1 (retry) when empty
+struct GLUE_PIPE
+{
+    std::string data;
+    size_t pos = 0;
+
+    // Chromium's SocketBIOAdapter: BIO reads are served from one socket read of up to capacity bytes
+    size_t capacity = 0; // 0: no adapter, reads take whatever is there
+    size_t buffered = 0;
+    uint64_t socket_reads = 0;
+};
+
+struct ssl_st
+{
+    std::unique_ptr<char[]> hostname;
+    std::unique_ptr<SSL_CONFIG> config;
+    std::unique_ptr<SSL3_STATE> s3;
+
+    // glue
+    std::vector<void *> ex_data;
+    GLUE_PIPE * rbio = nullptr;
+    GLUE_PIPE * wbio = nullptr;
+    uint16_t version = 0;
+    const SSL_CIPHER * cipher = nullptr;
+    bool established = false;
+
+    // boringssl.patch
+    bool is_gost : 1;
+};
+
+extern "C" {
+//
+int boring_BIO_read( SSL * s, void * data, int len );
+int boring_BIO_write( SSL * s, const void * data, int len );
+void boring_ERR_clear_error( void );
+void boring_ERR_put_error( int, int, int, const char * file, unsigned line );
+const SSL_CIPHER * boring_SSL_get_cipher_by_value( uint16_t value );
+int boring_SSL_get_ex_new_index( void );
+int boring_SSL_set_ex_data( SSL * s, int idx, void * data );
+void * boring_SSL_get_ex_data( const SSL * s, int idx );
+char boring_set_gost_cb( SSL * s, char is_gost );
+char boring_set_ca_names_cb( SSL * s, const char ** bufs, int * lens, size_t count );
+int boring_set_connected_cb( SSL * s, const char * alpn, size_t alpn_len,
+                             uint16_t version, uint16_t cipher_id,
+                             const char ** cert_bufs, int * cert_lens,
+                             size_t cert_count );
+//
+char gostssl();
+//
+int gostssl_init();
+int gostssl_connect( SSL * s, int * is_gost );
+int gostssl_read( SSL * s, void * buf, int len, int * is_gost );
+int gostssl_peek( SSL * s, void * buf, int len, int * is_gost );
+int gostssl_write( SSL * s, const void * buf, int len, int * is_gost );
+void gostssl_free( SSL * s );
+int gostssl_tls_gost_required( SSL * s );
+//
+}
+
+#endif // GOSTSSL_BENCH_INTERNAL_H
@@ -0,0 +1,1104 @@
+/* gostssl benchmarks over the mock msspi/CAPI backend
+
+   gostssl_bench [--quick] [lookup] [handshake] [write] [read] [churn] [clientcerts] [clientauth] [policy] [probe] [ciphers] [verify] [stats]
+
+   Numbers are gostssl.cpp overhead only: the mock does no cryptography and the loopback
+   pipes do no I/O. Compare runs of the same build host, not absolute values.
+   Some benchmarks check results too: a failed check is printed and the exit status is 1. */
+
+#include "glue.h"
+#include "mock_peer.h"
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+static unsigned bench_scale = 10; // --quick: 1
+
+static std::string bench_dir;
+static std::string bench_cert( 1200, '\x30' );
+static unsigned bench_failures = 0;
+static std::chrono::steady_clock::time_point bench_load_start; // the data directory is passed
+
+#define BENCH_POLICY_ENTRIES 100000
+#define BENCH_POLICY_GROUPS 997
+
+/* Environment: private data directory, policy and the mock store */
+
+static void bench_remove( const std::string & path )
+{
+    DIR * dir = opendir( path.c_str() );
+
+    if( dir )
+    {
+        for( struct dirent * e = readdir( dir ); e; e = readdir( dir ) )
+            if( strcmp( e->d_name, "." ) && strcmp( e->d_name, ".." ) )
+                bench_remove( path + "/" + e->d_name );
+
+        closedir( dir );
+        rmdir( path.c_str() );
+    }
+    else
+        unlink( path.c_str() );
+}
+
+static bool bench_setup()
+{
+    char dir[] = "/tmp/gostssl_bench.XXXXXX";
+
+    if( !mkdtemp( dir ) )
+        return false;
+
+    bench_dir = dir;
+
+    std::string policy = bench_dir + "/gostssl_policy";
+    FILE * f = fopen( policy.c_str(), "wb" );
+
+    if( !f )
+        return false;
+
+    fprintf( f, "*.gost.bench yes\n*.auto.bench auto\n" );
+
+    // bench_policy: the cases it checks and a large trie (exact names and wildcards in groups)
+    fprintf( f, "# checks\nexact.policy.bench yes\n*.wild.policy.bench no\n"
+                "*.deep.policy.bench no\n*.x.deep.policy.bench yes\nz.deep.policy.bench auto\n" );
+
+    for( unsigned i = 0; i < BENCH_POLICY_ENTRIES; i++ )
+        fprintf( f, i & 1 ? "*.h%u.g%u.policy.bench no\n" : "h%u.g%u.policy.bench auto\n", i, i % BENCH_POLICY_GROUPS );
+
+    fclose( f );
+
+    if( !gostssl() )
+        return false;
+
+    // the data directory of the "bench" network context, as Chromium passes a profile's
+    bench_load_start = std::chrono::steady_clock::now();
+    gostssl_datadirhook( (void *)"bench", 5, dir );
+    return true;
+}
+
+typedef void ( * MOCK_CAPI_SET_CERTS )( size_t count );
+
+static MOCK_CAPI_SET_CERTS bench_set_certs()
+{
+    void * lib = dlopen( CAPI20_LIB, RTLD_NOW );
+    return lib ? (MOCK_CAPI_SET_CERTS)dlsym( lib, "mock_capi_set_certs" ) : NULL;
+}
+
+/* Measurement */
+
+typedef std::chrono::steady_clock BENCH_CLOCK;
+
+static double bench_since( BENCH_CLOCK::time_point start )
+{
+    return std::chrono::duration<double>( BENCH_CLOCK::now() - start ).count();
+}
+
+static uint64_t bench_stat( const char * name )
+{
+    const char * names[64];
+    uint64_t values[64];
+    int count = gostssl_get_stats( names, values, 64 );
+
+    for( int i = 0; i < count; i++ )
+        if( 0 == strcmp( names[i], name ) )
+            return values[i];
+
+    return 0;
+}
+
+// operator new calls of the calling thread (std::string, std::vector, workers)
+static thread_local uint64_t bench_heap_allocs = 0;
+static thread_local uint64_t bench_heap_bytes = 0;
+
+void * operator new( size_t size )
+{
+    void * p = malloc( size ? size : 1 );
+
+    if( !p )
+        throw std::bad_alloc();
+
+    bench_heap_allocs++;
+    bench_heap_bytes += size;
+    return p;
+}
+
+void operator delete( void * p ) noexcept
+{
+    free( p );
+}
+
+void operator delete( void * p, size_t ) noexcept
+{
+    free( p );
+}
+
+static void bench_check( bool ok, const char * what )
+{
+    if( ok )
+        return;
+
+    bench_failures++;
+    printf( "check       FAILED %s\n", what );
+}
+
+#define BENCH_RUNS 3
+
+// runs fn( thread, run ) on every thread at once BENCH_RUNS times, returns the fastest wall time
+template <typename FN>
+static double bench_threads( unsigned threads, FN fn )
+{
+    double best = 0;
+
+    for( unsigned run = 0; run < BENCH_RUNS; run++ )
+    {
+        std::vector<std::thread> pool;
+        std::atomic<unsigned> ready( 0 );
+        std::atomic<bool> go( false );
+
+        for( unsigned t = 0; t < threads; t++ )
+            pool.push_back( std::thread( [&, t]()
+            {
+                ready++;
+                while( !go.load() )
+                    std::this_thread::yield();
+                fn( t, run );
+            } ) );
+
+        while( ready.load() < threads )
+            std::this_thread::yield();
+
+        BENCH_CLOCK::time_point start = BENCH_CLOCK::now();
+        go = true;
+
+        for( size_t i = 0; i < pool.size(); i++ )
+            pool[i].join();
+
+        double seconds = bench_since( start );
+
+        if( !run || seconds < best )
+            best = seconds;
+    }
+
+    return best;
+}
+
+/* Connections over loopback pipes */
+
+struct BENCH_CONN
+{
+    GLUE_PIPE c2s;
+    GLUE_PIPE s2c;
+    MOCK_PEER peer;
+    SSL * s;
+    uint64_t heap_allocs; // by gostssl_cachestring
+    uint64_t heap_bytes;
+    std::string client_cert; // chosen by bench_cert_cb
+};
+
+static BENCH_CONN * conn_new( const std::string & host )
+{
+    BENCH_CONN * c = new BENCH_CONN();
+
+    c->peer.in = &c->c2s;
+    c->peer.out = &c->s2c;
+    c->peer.cert = bench_cert;
+    c->s = glue_ssl_new( host.c_str(), &c->s2c, &c->c2s );
+
+    uint64_t allocs = bench_heap_allocs;
+    uint64_t bytes = bench_heap_bytes;
+    gostssl_cachestring( c->s, (void *)"bench", 5 );
+    c->heap_allocs = bench_heap_allocs - allocs;
+    c->heap_bytes = bench_heap_bytes - bytes;
+    return c;
+}
+
+static void conn_free( BENCH_CONN * c )
+{
+    glue_ssl_free( c->s );
+    delete c;
+}
+
+static bool conn_handshake( BENCH_CONN * c )
+{
+    for( int i = 0; i < 8; i++ )
+    {
+        int ret = glue_ssl_do_handshake( c->s );
+
+        if( ret == 1 )
+            return true;
+
+        if( ret == 0 || c->s->s3->rwstate != SSL_READING )
+            return false;
+
+        mock_peer_pump( c->peer );
+    }
+
+    return false;
+}
+
+/* Benchmarks: every row is the fastest of BENCH_RUNS runs, counters are per run */
+
+// workers_get behind every gostssl_read/peek/write call
+static void bench_lookup()
+{
+    const unsigned conns = 64;
+    const uint64_t ops = 400000ULL * bench_scale;
+    static const unsigned threads[] = { 1, 2, 4, 8 };
+
+    for( size_t n = 0; n < sizeof( threads ) / sizeof( threads[0] ); n++ )
+    {
+        unsigned t_count = threads[n];
+        std::vector< std::vector<BENCH_CONN *> > per_thread( t_count );
+
+        for( unsigned t = 0; t < t_count; t++ )
+            for( unsigned i = 0; i < conns; i++ )
+                per_thread[t].push_back( conn_new( "l" + std::to_string( t ) + "-" + std::to_string( i ) + ".auto.bench" ) );
+
+        double seconds = bench_threads( t_count, [&]( unsigned t, unsigned /* run */ )
+        {
+            std::vector<BENCH_CONN *> & mine = per_thread[t];
+            char buf[1];
+            int is_gost;
+
+            for( uint64_t i = 0; i < ops / t_count; i++ )
+                gostssl_read( mine[i % conns]->s, buf, 1, &is_gost );
+        } );
+
+        printf( "lookup      threads=%-2u          %8.2f Mops/s  %7.1f ns/op\n", t_count, ops / seconds / 1e6, seconds * 1e9 / ops );
+
+        for( unsigned t = 0; t < t_count; t++ )
+            for( unsigned i = 0; i < conns; i++ )
+                conn_free( per_thread[t][i] );
+    }
+}
+
+// BoringSSL got a GOST cipher suite from a host of unknown status (the stock handshake is not run)
+static bool conn_gost_required( BENCH_CONN * c )
+{
+    c->s->s3->hs->new_cipher = boring_SSL_get_cipher_by_value( 0xFF85 );
+    return gostssl_tls_gost_required( c->s ) == 1 && glue_err_last() == SSL_R_TLS_GOST_REQUIRED;
+}
+
+// full msspi handshakes: worker, msspi_open, connect round trips, host status, free;
+// known hosts (64 per thread) or discovery of a new one: the BoringSSL attempt that
+// reports SSL_R_TLS_GOST_REQUIRED, then the msspi resend that makes the host known
+static void bench_handshake()
+{
+    const unsigned per_host = 64;
+    const uint64_t total = 4000ULL * bench_scale;
+    static const unsigned threads[] = { 1, 2, 4, 8 };
+
+    for( int fresh = 0; fresh < 2; fresh++ )
+    {
+        for( size_t n = 0; n < sizeof( threads ) / sizeof( threads[0] ); n++ )
+        {
+            unsigned t_count = threads[n];
+            std::atomic<uint64_t> failed( 0 );
+            uint64_t opened = bench_stat( "msspi_opened" );
+
+            double seconds = bench_threads( t_count, [&]( unsigned t, unsigned run )
+            {
+                for( uint64_t i = 0; i < total / t_count; i++ )
+                {
+                    if( fresh )
+                    {
+                        std::string host = "n" + std::to_string( n ) + "-" + std::to_string( run ) + "-" + std::to_string( t ) + "-" + std::to_string( i ) + ".unknown.test";
+                        BENCH_CONN * c = conn_new( host );
+                        bool required = conn_gost_required( c );
+
+                        conn_free( c );
+
+                        if( !required )
+                        {
+                            failed++;
+                            continue;
+                        }
+
+                        c = conn_new( host );
+
+                        if( !conn_handshake( c ) )
+                            failed++;
+
+                        conn_free( c );
+                        continue;
+                    }
+
+                    BENCH_CONN * c = conn_new( "h" + std::to_string( t ) + "-" + std::to_string( i % per_host ) + ".gost.bench" );
+
+                    if( !conn_handshake( c ) )
+                        failed++;
+
+                    conn_free( c );
+                }
+            } );
+
+            printf( "handshake   threads=%-2u %-8s %8.0f hs/s    %7.2f us/hs  msspi_opened=%llu failed=%llu\n",
+                t_count, fresh ? "discover" : "known", total / seconds, seconds * 1e6 / total,
+                (unsigned long long)( bench_stat( "msspi_opened" ) - opened ) / BENCH_RUNS, (unsigned long long)failed.load() / BENCH_RUNS );
+        }
+    }
+}
+
+// gostssl_write of application buffers, the peer drains the pipe after every call
+static void bench_write()
+{
+    static const size_t sizes[] = { 16384, 4096, 1024 };
+    const uint64_t total = 32ULL * 1024 * 1024 * bench_scale;
+
+    for( size_t n = 0; n < sizeof( sizes ) / sizeof( sizes[0] ); n++ )
+    {
+        BENCH_CONN * c = conn_new( "w.gost.bench" );
+
+        if( !conn_handshake( c ) )
+        {
+            printf( "write       handshake failed\n" );
+            conn_free( c );
+            return;
+        }
+
+        std::string buf( sizes[n], 'w' );
+        uint64_t calls = total / sizes[n];
+        uint64_t records = bench_stat( "records_written" );
+        uint64_t writes = bench_stat( "bio_writes" );
+
+        double seconds = bench_threads( 1, [&]( unsigned /* t */, unsigned /* run */ )
+        {
+            for( uint64_t i = 0; i < calls; i++ )
+            {
+                glue_ssl_write( c->s, buf.data(), (int)buf.size() );
+                mock_peer_pump( c->peer );
+            }
+        } );
+
+        printf( "write       buf=%-6zu          %8.1f MB/s    %7.2f records/call  %5.2f bio_writes/call  received=%s\n",
+            sizes[n], total / seconds / 1048576,
+            (double)( bench_stat( "records_written" ) - records ) / calls / BENCH_RUNS,
+            (double)( bench_stat( "bio_writes" ) - writes ) / calls / BENCH_RUNS,
+            c->peer.received == total * BENCH_RUNS ? "ok" : "SHORT" );
+
+        conn_free( c );
+    }
+}
+
+// Chromium's SocketBIOAdapter reads the transport in kDefaultOpenSSLBufferSize pieces
+#define BENCH_ADAPTER_CAPACITY ( 17 * 1024 )
+
+// gostssl_read into 16K buffers through the adapter, the peer sends 256K of records at once,
+// every batch ends with an empty read as a socket waiting for the next segment does
+static void bench_read()
+{
+    static const size_t records[] = { 16384, 4096, 1024, 256 };
+    const uint64_t total = 32ULL * 1024 * 1024 * bench_scale;
+    const size_t batch = 256 * 1024;
+
+    for( size_t n = 0; n < sizeof( records ) / sizeof( records[0] ); n++ )
+    {
+        BENCH_CONN * c = conn_new( "r.gost.bench" );
+
+        if( !conn_handshake( c ) )
+        {
+            printf( "read        handshake failed\n" );
+            conn_free( c );
+            return;
+        }
+
+        c->s2c.capacity = BENCH_ADAPTER_CAPACITY;
+
+        std::vector<char> buf( 16384 );
+        uint64_t received = 0;
+        uint64_t reads = bench_stat( "bio_reads" );
+        uint64_t records_read = bench_stat( "records_read" );
+        uint64_t socket_reads = c->s2c.socket_reads;
+
+        double seconds = bench_threads( 1, [&]( unsigned /* t */, unsigned /* run */ )
+        {
+            for( uint64_t done = 0; done < total; )
+            {
+                mock_peer_send( c->peer, batch, records[n] );
+
+                for( ;; )
+                {
+                    int ret = glue_ssl_read( c->s, &buf[0], (int)buf.size() );
+                    if( ret <= 0 )
+                        break;
+                    done += (uint64_t)ret;
+                }
+            }
+
+            received += total;
+        } );
+
+        printf( "read        record=%-6zu       %8.1f MB/s    %7.2f bio_reads/record  %5.2f socket_reads/record\n",
+            records[n], total / seconds / 1048576,
+            (double)( bench_stat( "bio_reads" ) - reads ) / ( received / records[n] ),
+            (double)( c->s2c.socket_reads - socket_reads ) / ( received / records[n] ) );
+
+        // 16K reads take one record each
+        bench_check( bench_stat( "records_read" ) - records_read == received / records[n], "read: records_read counts the records" );
+
+        conn_free( c );
+    }
+}
+
+// connection setup and teardown for hosts of unknown status: misses, inserts, CLOCK evictions
+// and the heap gostssl_cachestring allocates for a connection that stays on BoringSSL
+static void bench_churn()
+{
+    const uint64_t total = 20000ULL * bench_scale;
+    const unsigned hot = 512;
+    static const unsigned threads[] = { 1, 4 };
+
+    for( size_t n = 0; n < sizeof( threads ) / sizeof( threads[0] ); n++ )
+    {
+        unsigned t_count = threads[n];
+
+        for( int pass = 0; pass < 2; pass++ )
+        {
+            uint64_t hits = bench_stat( "host_status_hits" );
+            uint64_t misses = bench_stat( "host_status_misses" );
+            uint64_t evictions = bench_stat( "host_status_evictions" );
+            std::atomic<uint64_t> heap_allocs( 0 );
+            std::atomic<uint64_t> heap_bytes( 0 );
+
+            double seconds = bench_threads( t_count, [&]( unsigned t, unsigned run )
+            {
+                for( uint64_t i = 0; i < total / t_count; i++ )
+                {
+                    // cold: every host is new, hot: a working set that fits the table
+                    std::string id = pass ? std::to_string( i % ( hot / t_count ) ) : std::to_string( run ) + "-" + std::to_string( i );
+                    BENCH_CONN * c = conn_new( "c" + std::to_string( n ) + "-" + std::to_string( t ) + "-" + id + ".unknown.test" );
+                    heap_allocs += c->heap_allocs;
+                    heap_bytes += c->heap_bytes;
+                    conn_free( c );
+                }
+            } );
+
+            printf( "churn       threads=%-2u %-8s %8.0f conn/s  %7.2f us/conn  heap=%.0f B/conn in %.1f allocs  hits=%llu misses=%llu evictions=%llu\n",
+                t_count, pass ? "hot" : "cold", total / seconds, seconds * 1e6 / total,
+                (double)heap_bytes.load() / total / BENCH_RUNS, (double)heap_allocs.load() / total / BENCH_RUNS,
+                (unsigned long long)( bench_stat( "host_status_hits" ) - hits ) / BENCH_RUNS,
+                (unsigned long long)( bench_stat( "host_status_misses" ) - misses ) / BENCH_RUNS,
+                (unsigned long long)( bench_stat( "host_status_evictions" ) - evictions ) / BENCH_RUNS );
+        }
+    }
+}
+
+// what a new connection to host gets: 'y' msspi, 'n' BoringSSL only, 'a' BoringSSL, then probing
+static char conn_policy( const char * host )
+{
+    BENCH_CONN * c = conn_new( host );
+    char status = c->s->is_gost ? 'y' : ( conn_gost_required( c ) ? 'a' : 'n' );
+
+    conn_free( c );
+    return status;
+}
+
+static double bench_load_seconds = 0;
+
+// policy trie: wildcard and suffix matching, then first connections (host status misses) to hosts
+// deep in the trie and to hosts outside of it, BENCH_POLICY_ENTRIES entries
+static void bench_policy()
+{
+    static const struct
+    {
+        const char * host;
+        char status;
+    }
+    checks[] =
+    {
+        { "exact.policy.bench", 'y' },
+        { "sub.exact.policy.bench", 'a' }, // a name does not cover its subdomains
+        { "wild.policy.bench", 'a' }, // nor does a wildcard cover its parent
+        { "a.wild.policy.bench", 'n' },
+        { "a.b.wild.policy.bench", 'n' }, // at any depth
+        { "xwild.policy.bench", 'a' }, // suffixes match at label boundaries only
+        { "A.Wild.Policy.BENCH", 'n' },
+        { "a.wild.policy.bench.", 'n' }, // fully qualified
+        { "y.deep.policy.bench", 'n' },
+        { "y.x.deep.policy.bench", 'y' }, // the longest match wins
+        { "x.deep.policy.bench", 'n' },
+        { "z.deep.policy.bench", 'a' }, // a name wins over the wildcard above it
+        { "policy.bench", 'a' },
+        { "h2.g2.policy.bench", 'a' },
+        { "h3.g3.policy.bench", 'a' },
+        { "c.h3.g3.policy.bench", 'n' },
+        { "c.h99999.g299.policy.bench", 'n' },
+        { "c.h99999.g298.policy.bench", 'a' },
+    };
+
+    for( size_t i = 0; i < sizeof( checks ) / sizeof( checks[0] ); i++ )
+    {
+        char status = conn_policy( checks[i].host );
+        std::string what = std::string( "policy " ) + checks[i].host + ": " + status + " instead of " + checks[i].status;
+
+        bench_check( status == checks[i].status, what.c_str() );
+    }
+
+    printf( "policy      entries=%u checks=%zu  loaded in %.1f ms\n", BENCH_POLICY_ENTRIES, sizeof( checks ) / sizeof( checks[0] ), bench_load_seconds * 1e3 );
+
+    const unsigned total = 10000 * bench_scale;
+
+    for( int matched = 1; matched >= 0; matched-- )
+    {
+        // every connection is to a new host
+        std::vector<std::string> hosts;
+
+        for( unsigned run = 0; run < BENCH_RUNS; run++ )
+        {
+            for( unsigned i = 0; i < total; i++ )
+            {
+                unsigned entry = ( i * 2 + 1 ) % BENCH_POLICY_ENTRIES;
+
+                if( matched )
+                    hosts.push_back( "c" + std::to_string( run ) + "-" + std::to_string( i ) + ".h" + std::to_string( entry ) + ".g" + std::to_string( entry % BENCH_POLICY_GROUPS ) + ".policy.bench" );
+                else
+                    hosts.push_back( "c" + std::to_string( run ) + "-" + std::to_string( i ) + ".h" + std::to_string( entry ) + ".g" + std::to_string( entry % BENCH_POLICY_GROUPS ) + ".unknown.test" );
+            }
+        }
+
+        std::atomic<unsigned> mismatches( 0 );
+
+        double seconds = bench_threads( 1, [&]( unsigned /* t */, unsigned run )
+        {
+            for( unsigned i = 0; i < total; i++ )
+            {
+                BENCH_CONN * c = conn_new( hosts[run * total + i] );
+                conn_free( c );
+            }
+        } );
+
+        // the same hosts are cached by now
+        for( unsigned i = 0; i < total; i += total / 16 )
+            if( conn_policy( hosts[i].c_str() ) != ( matched ? 'n' : 'a' ) )
+                mismatches++;
+
+        bench_check( !mismatches, matched ? "policy matched hosts" : "policy unmatched hosts" );
+
+        printf( "policy      %-9s           %8.0f conn/s  %7.2f us/conn\n", matched ? "matched" : "unmatched", total / seconds, seconds * 1e6 / total );
+    }
+}
+
+// gostssl_clientcertshook: first call after an invalidation, then served from the snapshot
+static void bench_clientcerts()
+{
+    static const size_t counts[] = { 16, 256 };
+    const unsigned calls = 2000 * bench_scale;
+    MOCK_CAPI_SET_CERTS set_certs = bench_set_certs();
+
+    if( !set_certs )
+    {
+        printf( "clientcerts mock_capi_set_certs not found in %s\n", CAPI20_LIB );
+        return;
+    }
+
+    for( size_t n = 0; n < sizeof( counts ) / sizeof( counts[0] ); n++ )
+    {
+        char ** certs;
+        int * lens;
+        wchar_t ** names;
+        int count = 0;
+        int is_gost;
+        double cold = 0;
+
+        for( unsigned run = 0; run < BENCH_RUNS; run++ )
+        {
+            set_certs( counts[n] );
+            gostssl_certdbchangedhook();
+
+            BENCH_CLOCK::time_point start = BENCH_CLOCK::now();
+            gostssl_clientcertshook( &certs, &lens, &names, &count, &is_gost );
+            double seconds = bench_since( start );
+
+            if( !run || seconds < cold )
+                cold = seconds;
+        }
+
+        double warm = bench_threads( 1, [&]( unsigned /* t */, unsigned /* run */ )
+        {
+            for( unsigned i = 0; i < calls; i++ )
+                gostssl_clientcertshook( &certs, &lens, &names, &count, &is_gost );
+        } ) / calls;
+
+        printf( "clientcerts certs=%-4zu          %8.1f us cold  %7.2f us warm  count=%d\n", counts[n], cold * 1e6, warm * 1e6, count );
+    }
+}
+
+// a mock certificate has ( index * 131 + offset * 7 + generation ) & 0xFF at every offset
+static bool bench_view_intact( char ** certs, int * lens, wchar_t ** names, int count )
+{
+    for( int i = 0; i < count; i++ )
+    {
+        if( lens[i] < 2 || wcscmp( names[i], L"Mock User (Mock CA)" ) )
+            return false;
+
+        if( (uint8_t)( certs[i][0] - i * 131 ) != (uint8_t)certs[0][0] )
+            return false;
+
+        for( int j = 1; j < lens[i]; j++ )
+            if( (uint8_t)( certs[i][j] - certs[i][j - 1] ) != 7 )
+                return false;
+    }
+
+    return true;
+}
+
+static std::atomic<uint64_t> bench_views_torn( 0 );
+
+// Chromium's certificate request, synchronous here: the client certificate store lookup
+// (gostssl_clientcertshook) and the choice of one of its certificates (gostssl_certhook)
+static int bench_cert_cb( SSL * s, void * arg )
+{
+    BENCH_CONN * c = (BENCH_CONN *)arg;
+    char ** certs;
+    int * lens;
+    wchar_t ** names;
+    int count;
+    int is_gost;
+
+    gostssl_clientcertshook( &certs, &lens, &names, &count, &is_gost );
+
+    if( !count )
+        return 1;
+
+    int i = count - 1;
+    c->client_cert.assign( certs[i], (size_t)lens[i] );
+    gostssl_certhook( s, certs[i], lens[i] );
+
+    // the store may have changed meanwhile, the view may not
+    if( !bench_view_intact( certs, lens, names, count ) )
+        bench_views_torn++;
+
+    return 1;
+}
+
+// gostssl_clientcertshook under store changes: a view held across a swap, then concurrent
+// client-auth handshakes while another thread keeps replacing the store
+static void bench_clientauth()
+{
+    const uint64_t total = 400ULL * bench_scale;
+    static const unsigned threads[] = { 1, 4, 8 };
+    MOCK_CAPI_SET_CERTS set_certs = bench_set_certs();
+
+    if( !set_certs )
+    {
+        printf( "clientauth  mock_capi_set_certs not found in %s\n", CAPI20_LIB );
+        return;
+    }
+
+    char ** certs;
+    int * lens;
+    wchar_t ** names;
+    int count = 0;
+    int is_gost;
+    int swapped = 0;
+
+    set_certs( 4 );
+    gostssl_certdbchangedhook();
+    gostssl_clientcertshook( &certs, &lens, &names, &count, &is_gost );
+
+    // another thread publishes a new snapshot, this one keeps reading the old one
+    std::thread( [&]()
+    {
+        char ** other_certs;
+        int * other_lens;
+        wchar_t ** other_names;
+        int other_is_gost;
+
+        set_certs( 8 );
+        gostssl_certdbchangedhook();
+        gostssl_clientcertshook( &other_certs, &other_lens, &other_names, &swapped, &other_is_gost );
+    } ).join();
+
+    bench_check( swapped == 8, "clientauth swap: the other thread sees the new store" );
+    bench_check( count == 4 && bench_view_intact( certs, lens, names, count ), "clientauth swap: the held view is unchanged" );
+
+    gostssl_clientcertshook( &certs, &lens, &names, &count, &is_gost );
+    bench_check( count == 8 && bench_view_intact( certs, lens, names, count ), "clientauth swap: the next call sees the new store" );
+
+    for( size_t n = 0; n < sizeof( threads ) / sizeof( threads[0] ); n++ )
+    {
+        unsigned t_count = threads[n];
+        std::atomic<uint64_t> failed( 0 );
+        std::atomic<uint64_t> swaps( 0 );
+        std::atomic<unsigned> done( 0 );
+        bench_views_torn = 0;
+
+        // the last thread is the store writer, it stops when the handshakes are done
+        double seconds = bench_threads( t_count + 1, [&]( unsigned t, unsigned /* run */ )
+        {
+            if( t == t_count )
+            {
+                for( unsigned k = 0; done.load() < t_count; k++ )
+                {
+                    set_certs( 1 + k % 16 );
+                    gostssl_certdbchangedhook();
+                    swaps++;
+                    std::this_thread::yield();
+                }
+
+                done = 0;
+                return;
+            }
+
+            for( uint64_t i = 0; i < total / t_count; i++ )
+            {
+                BENCH_CONN * c = conn_new( "a" + std::to_string( t ) + "-" + std::to_string( i % 64 ) + ".gost.bench" );
+
+                c->peer.request_cert = true;
+                c->s->config->cert.reset( new CERT() );
+                c->s->config->cert->cert_cb = bench_cert_cb;
+                c->s->config->cert->cert_cb_arg = c;
+
+                bool ok = conn_handshake( c );
+                mock_peer_pump( c->peer );
+
+                if( !ok || c->client_cert.empty() || c->peer.client_cert != c->client_cert )
+                    failed++;
+
+                conn_free( c );
+            }
+
+            done++;
+        } );
+
+        printf( "clientauth  threads=%-2u          %8.0f hs/s    %7.2f us/hs  swaps=%llu failed=%llu\n",
+            t_count, total / seconds, seconds * 1e6 / total,
+            (unsigned long long)swaps.load() / BENCH_RUNS, (unsigned long long)failed.load() / BENCH_RUNS );
+
+        bench_check( !failed.load(), "clientauth: every handshake sent the certificate it chose" );
+        bench_check( !bench_views_torn.load(), "clientauth: views stay intact while the store changes" );
+    }
+}
+
+// a new connection to host: the BoringSSL attempt unless the host is known, then the msspi
+// (re)send; 'n': BoringSSL only, 'y': msspi connected, 'f': msspi failed
+static char conn_probe( const std::string & host, bool fail, bool reject_cert )
+{
+    BENCH_CONN * c = conn_new( host );
+
+    if( !c->s->is_gost )
+    {
+        bool required = conn_gost_required( c );
+
+        conn_free( c );
+
+        if( !required )
+            return 'n';
+
+        c = conn_new( host );
+    }
+
+    // no certificate callback: an empty certificate goes out
+    c->peer.fail = fail;
+    c->peer.request_cert = reject_cert;
+    c->peer.reject_cert = reject_cert;
+
+    bool ok = conn_handshake( c );
+
+    conn_free( c );
+    return ok ? 'y' : 'f';
+}
+
+// the probe controller: failed probes back off to stock BoringSSL, a rejected client
+// certificate is not a failed probe, hosts that connected over msspi before back off too
+static void bench_probe()
+{
+    uint64_t failed = bench_stat( "probes_failed" );
+    uint64_t saved = bench_stat( "probes_saved" );
+    std::string probes;
+
+    // HOST_PROBES_FREE retries, then the backoff
+    for( int i = 0; i < 4; i++ )
+        probes += conn_probe( "fail.probe.unknown.test", false, false );
+
+    std::string failing = probes;
+
+    BENCH_CONN * c = conn_new( "fail.probe.unknown.test" );
+    c->s->s3->hs->new_cipher = boring_SSL_get_cipher_by_value( 0xFF85 );
+    boring_ERR_clear_error();
+    bench_check( gostssl_tls_gost_required( c->s ) == 0 && !glue_err_last(), "probe: a host in backoff falls back to BoringSSL" );
+    conn_free( c );
+
+    bench_check( probes == "fffn", "probe: a failing host backs off after 3 failures" );
+    bench_check( bench_stat( "probes_failed" ) - failed == 3, "probe: failures are counted" );
+    bench_check( bench_stat( "probes_saved" ) - saved == 2, "probe: probes are saved in backoff" );
+
+    failed = bench_stat( "probes_failed" );
+    probes.clear();
+
+    for( int i = 0; i < 4; i++ )
+        probes += conn_probe( "reject.probe.unknown.test", false, true );
+
+    bench_check( probes == "ffff" && bench_stat( "probes_failed" ) == failed, "probe: rejected client certificates are not failed probes" );
+
+    std::string rejected = probes;
+
+    // a GOST host, then its status is forgotten (a hosts file is read) and it starts failing
+    std::string dir = bench_dir + "/probe";
+    std::string hosts = dir + "/gostssl_hosts";
+    FILE * f = NULL;
+
+    if( mkdir( dir.c_str(), 0700 ) == 0 )
+        f = fopen( hosts.c_str(), "wb" );
+
+    if( !f )
+    {
+        bench_check( false, "probe: hosts file" );
+        return;
+    }
+
+    fprintf( f, "%lld other.probe.test\n", (long long)time( NULL ) + 3600 );
+    fclose( f );
+
+    probes = conn_probe( "gost.probe.unknown.test", false, false );
+
+    BENCH_CLOCK::time_point start = BENCH_CLOCK::now();
+
+    gostssl_datadirhook( (void *)"probe", 5, dir.c_str() );
+
+    // the file is read in the background, then the host status is looked up again
+    while( bench_since( start ) < 10 )
+    {
+        uint64_t misses = bench_stat( "host_status_misses" );
+
+        conn_free( conn_new( "gost.probe.unknown.test" ) );
+
+        if( bench_stat( "host_status_misses" ) != misses )
+            break;
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+
+    for( int i = 0; i < 4; i++ )
+        probes += conn_probe( "gost.probe.unknown.test", true, false );
+
+    printf( "probe       failing=%s rejected=%s was_gost=%s\n", failing.c_str(), rejected.c_str(), probes.c_str() );
+    bench_check( probes == "yfffn", "probe: a host that connected before backs off too" );
+}
+
+// what BoringSSL is told about msspi handshakes: TLS 1.2 and the RFC 9367 TLS 1.3 suites,
+// with the protocol as a version and as SChannel's SP_PROT_TLS1_3 client and server flags
+static void bench_ciphers()
+{
+    static const struct
+    {
+        uint32_t protocol;
+        uint16_t version;
+    }
+    protocols[] =
+    {
+        { 0x00000303, TLS1_2_VERSION },
+        { 0x00000304, TLS1_3_VERSION },
+        { 0x00001000, TLS1_3_VERSION },
+        { 0x00002000, TLS1_3_VERSION },
+    };
+
+    static const uint16_t ciphers[] = { 0xFF85, 0xC103, 0xC104, 0xC105, 0xC106 };
+
+    for( size_t i = 0; i < sizeof( ciphers ) / sizeof( ciphers[0] ); i++ )
+    {
+        std::string versions;
+
+        for( size_t j = 0; j < sizeof( protocols ) / sizeof( protocols[0] ); j++ )
+        {
+            char host[64];
+            snprintf( host, sizeof( host ), "m%04x-%x.gost.bench", ciphers[i], protocols[j].protocol );
+
+            BENCH_CONN * c = conn_new( host );
+            c->peer.cipher = ciphers[i];
+            c->peer.protocol = protocols[j].protocol;
+
+            bool ok = conn_handshake( c ) && c->s->established &&
+                      c->s->version == protocols[j].version && c->s->cipher && c->s->cipher->id == ciphers[i];
+
+            char version[16];
+            snprintf( version, sizeof( version ), " %x:%x", protocols[j].protocol, c->s->version );
+            versions += version;
+
+            bench_check( ok, host );
+            conn_free( c );
+        }
+
+        printf( "ciphers     cipher=%04x          %s\n", ciphers[i], versions.c_str() );
+    }
+}
+
+static thread_local unsigned bench_verified;
+static thread_local std::vector<std::string> bench_verified_chain;
+
+static void bench_verify_cb( SSL * s, const char ** certs, const int * lens, size_t count )
+{
+    gostssl_verifychainhook( s->hostname.get(), certs, lens, count, &bench_verified );
+
+    bench_verified_chain.clear();
+    for( size_t i = 0; i < count; i++ )
+        bench_verified_chain.push_back( std::string( certs[i], (size_t)lens[i] ) );
+}
+
+// gostssl_verifychainhook takes only chains of msspi handshakes in progress,
+// the same chain for the same host afterwards is left to Chromium
+static void bench_verify()
+{
+    glue_set_verify_cb( bench_verify_cb );
+
+    BENCH_CONN * c = conn_new( "v.gost.bench" );
+    bench_verified = 0;
+    bool ok = conn_handshake( c );
+    unsigned during = bench_verified;
+    conn_free( c );
+
+    glue_set_verify_cb( NULL );
+
+    std::vector<const char *> certs;
+    std::vector<int> lens;
+    for( size_t i = 0; i < bench_verified_chain.size(); i++ )
+    {
+        certs.push_back( bench_verified_chain[i].data() );
+        lens.push_back( (int)bench_verified_chain[i].size() );
+    }
+
+    unsigned after = 0xFFFFFFFF;
+    if( !certs.empty() )
+        gostssl_verifychainhook( "v.gost.bench", &certs[0], &lens[0], certs.size(), &after );
+
+    printf( "verify      handshake=%u after=%u\n", during, after );
+
+    bench_check( ok && during == 1, "verify: the msspi handshake chain is verified by the CSP" );
+    bench_check( after == 0, "verify: chains outside msspi handshakes are left to Chromium" );
+}
+
+static std::mutex & bench_samples_mutex = *( new std::mutex() );
+static std::map< std::string, std::vector<uint64_t> > & bench_samples = *( new std::map< std::string, std::vector<uint64_t> >() );
+static std::map< std::string, int > & bench_sample_kinds = *( new std::map< std::string, int >() );
+
+static void bench_histogram( const char * name, uint64_t sample, int is_count )
+{
+    std::unique_lock<std::mutex> lck( bench_samples_mutex );
+    bench_samples[name].push_back( sample );
+    bench_sample_kinds[name] = is_count;
+}
+
+// gostssl_set_histogram_cb: durations per sample, counters in the first report
+// (the next connection after the callback is set) as their totals so far
+static void bench_stats()
+{
+    BENCH_CONN * c = conn_new( "s.gost.bench" );
+    bool ok = conn_handshake( c );
+    std::vector<char> buf( 16384 );
+
+    mock_peer_send( c->peer, 4 * 16384, 16384 );
+    while( glue_ssl_read( c->s, &buf[0], (int)buf.size() ) > 0 )
+        ;
+    conn_free( c );
+
+    uint64_t records_read = bench_stat( "records_read" );
+    uint64_t handshakes = bench_stat( "handshakes" );
+
+    gostssl_set_histogram_cb( bench_histogram );
+
+    c = conn_new( "s.gost.bench" );
+    ok = conn_handshake( c ) && ok;
+    conn_free( c );
+
+    gostssl_set_histogram_cb( NULL );
+
+    std::unique_lock<std::mutex> lck( bench_samples_mutex );
+    std::vector<uint64_t> & reported = bench_samples["Net.GostSSL.Count.records_read"];
+
+    printf( "stats       histograms=%-4zu      records_read=%llu reported=%llu\n", bench_samples.size(),
+        (unsigned long long)records_read, (unsigned long long)( reported.empty() ? 0 : reported[0] ) );
+
+    bench_check( ok, "stats: handshakes" );
+    bench_check( reported.size() == 1 && reported[0] == records_read && records_read >= 4, "stats: records_read is reported once with its total" );
+    bench_check( bench_samples["Net.GostSSL.Count.handshakes"] == std::vector<uint64_t>( 1, handshakes ), "stats: handshakes are reported" );
+    bench_check( bench_sample_kinds["Net.GostSSL.Count.handshakes"] == 1, "stats: counters are reported as counts" );
+    bench_check( bench_samples["Net.GostSSL.HandshakeTime"].size() == 1 && bench_sample_kinds["Net.GostSSL.HandshakeTime"] == 0, "stats: durations are reported per sample" );
+    bench_check( !bench_samples.count( "Net.GostSSL.Count.handshake_us" ), "stats: durations are not reported as counters" );
+}
+
+int main( int argc, char ** argv )
+{
+    std::vector<std::string> only;
+
+    for( int i = 1; i < argc; i++ )
+    {
+        if( 0 == strcmp( argv[i], "--quick" ) )
+            bench_scale = 1;
+        else
+            only.push_back( argv[i] );
+    }
+
+    if( !bench_setup() )
+    {
+        fprintf( stderr, "gostssl initialization failed (CAPI: %s)\n", CAPI20_LIB );
+        return 1;
+    }
+
+    // the policy and hosts files are read in the background
+    while( bench_stat( "files_loaded" ) < 2 )
+    {
+        if( bench_since( bench_load_start ) > 10 )
+        {
+            fprintf( stderr, "gostssl data directory was not read\n" );
+            return 1;
+        }
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+
+    bench_load_seconds = bench_since( bench_load_start );
+
+    struct
+    {
+        const char * name;
+        void ( * fn )();
+    }
+    benches[] =
+    {
+        { "lookup", bench_lookup },
+        { "handshake", bench_handshake },
+        { "write", bench_write },
+        { "read", bench_read },
+        { "churn", bench_churn },
+        { "clientcerts", bench_clientcerts },
+        { "clientauth", bench_clientauth },
+        { "policy", bench_policy },
+        { "probe", bench_probe },
+        { "ciphers", bench_ciphers },
+        { "verify", bench_verify },
+        { "stats", bench_stats },
+    };
+
+    printf( "gostssl_bench: %u hardware threads%s\n", std::thread::hardware_concurrency(), bench_scale == 1 ? ", quick" : "" );
+
+    for( size_t i = 0; i < sizeof( benches ) / sizeof( benches[0] ); i++ )
+    {
+        bool run = only.empty();
+
+        for( size_t j = 0; j < only.size(); j++ )
+            if( only[j] == benches[i].name )
+                run = true;
+
+        if( run )
+            benches[i].fn();
+    }
+
+    bench_remove( bench_dir );
+    return bench_failures ? 1 : 0;
+}
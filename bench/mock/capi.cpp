@@ -0,0 +1,233 @@
+/* Mock capi10/capi20 for the benchmark, loaded by gostssl.cpp through CAPI10_LIB and CAPI20_LIB
+
+   The "MY" system store holds MOCK_CAPI_CERTS synthetic certificates (16 by default), all valid
+   for signing with a private key. mock_capi_set_certs() replaces them, as a user adding or
+   removing certificates would. Chain building always succeeds. */
+
+#include "CSP_WinCrypt.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define MOCK_CERT_SIZE 1400
+
+struct MOCK_CERT
+{
+    CERT_CONTEXT ctx;
+    CERT_INFO info;
+    std::string der;
+    std::wstring name;
+    size_t index; // in the store
+};
+
+struct MOCK_STORE
+{
+    std::vector<MOCK_CERT *> certs;
+    bool system;
+};
+
+static std::mutex & mock_mutex = *( new std::mutex() );
+static std::vector<MOCK_CERT *> & mock_my = *( new std::vector<MOCK_CERT *>() );
+static unsigned mock_generation = 0;
+static bool mock_my_ready = false;
+
+static MOCK_CERT * mock_cert_new( const BYTE * der, DWORD len, HCERTSTORE store, size_t index )
+{
+    MOCK_CERT * cert = new MOCK_CERT();
+
+    cert->der.assign( (const char *)der, len );
+    memset( &cert->info, 0, sizeof( cert->info ) );
+    cert->info.NotBefore.dwHighDateTime = 0x01000000; // 1985
+    cert->info.NotAfter.dwHighDateTime = 0x7F000000; // far future
+    cert->ctx.dwCertEncodingType = X509_ASN_ENCODING;
+    cert->ctx.pbCertEncoded = (BYTE *)&cert->der[0];
+    cert->ctx.cbCertEncoded = len;
+    cert->ctx.pCertInfo = &cert->info;
+    cert->ctx.hCertStore = store;
+    cert->name = L"Mock User";
+    cert->index = index;
+    return cert;
+}
+
+static MOCK_CERT * mock_cert_of( PCCERT_CONTEXT ctx )
+{
+    return (MOCK_CERT *)( (char *)ctx - offsetof( MOCK_CERT, ctx ) );
+}
+
+// mock_mutex must be held
+static void mock_my_fill( size_t count )
+{
+    for( size_t i = 0; i < mock_my.size(); i++ )
+        delete mock_my[i];
+
+    mock_my.clear();
+    mock_generation++;
+
+    for( size_t i = 0; i < count; i++ )
+    {
+        std::string der( MOCK_CERT_SIZE, '\0' );
+
+        for( size_t j = 0; j < der.size(); j++ )
+            der[j] = (char)( ( i * 131 + j * 7 + mock_generation ) & 0xFF );
+
+        mock_my.push_back( mock_cert_new( (const BYTE *)der.data(), (DWORD)der.size(), (HCERTSTORE)&mock_my, i ) );
+    }
+
+    mock_my_ready = true;
+}
+
+extern "C" void mock_capi_set_certs( size_t count )
+{
+    std::unique_lock<std::mutex> lck( mock_mutex );
+    mock_my_fill( count );
+}
+
+BOOL WINAPI CryptAcquireContextA( HCRYPTPROV * phProv, LPCSTR /* szContainer */, LPCSTR /* szProvider */, DWORD /* dwProvType */, DWORD /* dwFlags */ )
+{
+    *phProv = 1;
+    return TRUE;
+}
+
+BOOL WINAPI CryptReleaseContext( HCRYPTPROV /* hProv */, DWORD /* dwFlags */ )
+{
+    return TRUE;
+}
+
+// the system store is shared, its certificates belong to it; snapshots are taken for enumeration
+HCERTSTORE WINAPI CertOpenStore( LPCSTR lpszStoreProvider, DWORD /* dwEncodingType */, HCRYPTPROV /* hCryptProv */, DWORD /* dwFlags */, const void * /* pvPara */ )
+{
+    MOCK_STORE * store = new MOCK_STORE();
+
+    store->system = lpszStoreProvider == CERT_STORE_PROV_SYSTEM_A;
+
+    if( store->system )
+    {
+        std::unique_lock<std::mutex> lck( mock_mutex );
+
+        if( !mock_my_ready )
+        {
+            const char * env = getenv( "MOCK_CAPI_CERTS" );
+            mock_my_fill( env ? (size_t)atoi( env ) : 16 );
+        }
+
+        for( size_t i = 0; i < mock_my.size(); i++ )
+            store->certs.push_back( mock_cert_new( mock_my[i]->ctx.pbCertEncoded, mock_my[i]->ctx.cbCertEncoded, store, i ) );
+    }
+
+    return store;
+}
+
+BOOL WINAPI CertCloseStore( HCERTSTORE hCertStore, DWORD /* dwFlags */ )
+{
+    MOCK_STORE * store = (MOCK_STORE *)hCertStore;
+
+    for( size_t i = 0; i < store->certs.size(); i++ )
+        delete store->certs[i];
+
+    delete store;
+    return TRUE;
+}
+
+PCCERT_CONTEXT WINAPI CertFindCertificateInStore( HCERTSTORE hCertStore, DWORD /* dwCertEncodingType */, DWORD /* dwFindFlags */, DWORD dwFindType, const void * /* pvFindPara */, PCCERT_CONTEXT pPrevCertContext )
+{
+    MOCK_STORE * store = (MOCK_STORE *)hCertStore;
+    size_t next = pPrevCertContext ? mock_cert_of( pPrevCertContext )->index + 1 : 0;
+
+    if( dwFindType != CERT_FIND_ANY || next >= store->certs.size() )
+        return NULL;
+
+    return &store->certs[next]->ctx;
+}
+
+PCCERT_CONTEXT WINAPI CertCreateCertificateContext( DWORD /* dwCertEncodingType */, const BYTE * pbCertEncoded, DWORD cbCertEncoded )
+{
+    return &mock_cert_new( pbCertEncoded, cbCertEncoded, NULL, 0 )->ctx;
+}
+
+PCCERT_CONTEXT WINAPI CertDuplicateCertificateContext( PCCERT_CONTEXT pCertContext )
+{
+    return &mock_cert_new( pCertContext->pbCertEncoded, pCertContext->cbCertEncoded, NULL, 0 )->ctx;
+}
+
+// certificates of a store are freed with it
+BOOL WINAPI CertFreeCertificateContext( PCCERT_CONTEXT pCertContext )
+{
+    if( pCertContext && !pCertContext->hCertStore )
+        delete mock_cert_of( pCertContext );
+
+    return TRUE;
+}
+
+BOOL WINAPI CertAddEncodedCertificateToStore( HCERTSTORE hCertStore, DWORD /* dwCertEncodingType */, const BYTE * pbCertEncoded, DWORD cbCertEncoded, DWORD /* dwAddDisposition */, PCCERT_CONTEXT * ppCertContext )
+{
+    MOCK_STORE * store = (MOCK_STORE *)hCertStore;
+    MOCK_CERT * cert = mock_cert_new( pbCertEncoded, cbCertEncoded, store, store->certs.size() );
+
+    store->certs.push_back( cert );
+
+    if( ppCertContext )
+        *ppCertContext = &mock_cert_new( pbCertEncoded, cbCertEncoded, NULL, 0 )->ctx;
+
+    return TRUE;
+}
+
+BOOL WINAPI CertGetCertificateContextProperty( PCCERT_CONTEXT /* pCertContext */, DWORD dwPropId, void * /* pvData */, DWORD * pcbData )
+{
+    if( dwPropId != CERT_KEY_PROV_INFO_PROP_ID )
+        return FALSE;
+
+    *pcbData = 64;
+    return TRUE;
+}
+
+BOOL WINAPI CertGetIntendedKeyUsage( DWORD /* dwCertEncodingType */, PCERT_INFO /* pCertInfo */, BYTE * pbKeyUsage, DWORD cbKeyUsage )
+{
+    if( cbKeyUsage )
+        pbKeyUsage[0] = CERT_DIGITAL_SIGNATURE_KEY_USAGE;
+
+    return TRUE;
+}
+
+LONG WINAPI CertVerifyTimeValidity( LPFILETIME /* pTimeToVerify */, PCERT_INFO /* pCertInfo */ )
+{
+    return 0;
+}
+
+DWORD WINAPI CertGetNameStringW( PCCERT_CONTEXT pCertContext, DWORD /* dwType */, DWORD dwFlags, void * /* pvTypePara */, LPWSTR pszNameString, DWORD cchNameString )
+{
+    const std::wstring & name = ( dwFlags & CERT_NAME_ISSUER_FLAG ) ? std::wstring( L"Mock CA" ) : mock_cert_of( pCertContext )->name;
+    DWORD len = (DWORD)name.size() + 1;
+
+    if( !pszNameString )
+        return len;
+
+    if( len > cchNameString )
+        len = cchNameString;
+
+    wcsncpy( pszNameString, name.c_str(), len - 1 );
+    pszNameString[len - 1] = 0;
+    return len;
+}
+
+static const CERT_CHAIN_CONTEXT mock_chain = { sizeof( CERT_CHAIN_CONTEXT ), { 0, 0 } };
+
+BOOL WINAPI CertGetCertificateChain( HCERTCHAINENGINE /* hChainEngine */, PCCERT_CONTEXT /* pCertContext */, LPFILETIME /* pTime */, HCERTSTORE /* hAdditionalStore */, PCERT_CHAIN_PARA /* pChainPara */, DWORD /* dwFlags */, LPVOID /* pvReserved */, PCCERT_CHAIN_CONTEXT * ppChainContext )
+{
+    *ppChainContext = &mock_chain;
+    return TRUE;
+}
+
+void WINAPI CertFreeCertificateChain( PCCERT_CHAIN_CONTEXT /* pChainContext */ )
+{
+}
+
+BOOL WINAPI CertVerifyCertificateChainPolicy( LPCSTR /* pszPolicyOID */, PCCERT_CHAIN_CONTEXT /* pChainContext */, PCERT_CHAIN_POLICY_PARA /* pPolicyPara */, PCERT_CHAIN_POLICY_STATUS pPolicyStatus )
+{
+    pPolicyStatus->dwError = 0;
+    return TRUE;
+}
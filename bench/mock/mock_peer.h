@@ -0,0 +1,45 @@
+/* The server end of a loopback connection for the mock msspi
+
+   Records are TLS-shaped: type, version (2), length (2), body XORed with MOCK_RECORD_KEY.
+   The client hello carries the host name, the server hello carries the cipher suite, the
+   protocol (dwProtocol, 4 bytes), a certificate request flag and the server certificate; a requested client certificate
+   follows the client hello in a second handshake record (empty: none), the server accepts
+   it with an empty handshake record or rejects it with an alert.
+   Hosts starting with "fail." get a handshake failure alert. */
+
+#ifndef GOSTSSL_BENCH_MOCK_PEER_H
+#define GOSTSSL_BENCH_MOCK_PEER_H
+
+#include <../ssl/internal.h>
+
+#define MOCK_RECORD_HANDSHAKE 0x16
+#define MOCK_RECORD_ALERT 0x15
+#define MOCK_RECORD_DATA 0x17
+#define MOCK_RECORD_HEADER 5
+#define MOCK_RECORD_MAX 16384
+#define MOCK_RECORD_KEY 0x5A
+
+struct MOCK_PEER
+{
+    GLUE_PIPE * in = nullptr; // client to server
+    GLUE_PIPE * out = nullptr; // server to client
+    uint16_t cipher = 0xFF85;
+    uint32_t protocol = 0x00000303; // as SChannel reports it: a version or an SP_PROT_* flag
+    std::string cert;
+    bool fail = false; // as for a "fail." host
+    bool request_cert = false;
+    bool reject_cert = false;
+    std::string client_cert; // sent by the client when requested
+    uint64_t received = 0; // application data bytes
+    size_t hellos = 0;
+};
+
+void mock_record_append( std::string & out, uint8_t type, const void * body, size_t len );
+
+// answers hellos and drains application data the client has written so far
+void mock_peer_pump( MOCK_PEER & peer );
+
+// queues application data for the client in records of the given size
+void mock_peer_send( MOCK_PEER & peer, size_t bytes, size_t record );
+
+#endif // GOSTSSL_BENCH_MOCK_PEER_H
@@ -0,0 +1,466 @@
+/* Deterministic in-process msspi for the benchmark
+
+   No cryptography: records are framed like TLS and XORed, see mock_peer.h. Reads go through
+   the read callback the way msspi does, the record header first and then the body. */
+
+#include <msspi.h>
+
+#include "mock_peer.h"
+
+#include <string.h>
+
+struct MSSPI
+{
+    void * arg;
+    msspi_read_cb read_cb;
+    msspi_write_cb write_cb;
+    msspi_cert_cb cert_cb;
+
+    std::string hostname;
+    std::string cachestring;
+    std::string mycert;
+
+    int state;
+    bool hello_sent;
+    bool hello_received;
+    bool cert_requested;
+    bool cert_sent;
+    bool connected;
+
+    std::string rec; // record being received
+    std::string wrec; // record being sent
+    std::string plain; // application data not returned yet
+    size_t plain_pos;
+
+    SecPkgContext_CipherInfo cipher_info;
+    std::string peercert;
+};
+
+void mock_record_append( std::string & out, uint8_t type, const void * body, size_t len )
+{
+    size_t start = out.size();
+
+    out.resize( start + MOCK_RECORD_HEADER + len );
+
+    char * p = &out[start];
+    p[0] = (char)type;
+    p[1] = 0x03;
+    p[2] = 0x03;
+    p[3] = (char)( len >> 8 );
+    p[4] = (char)( len & 0xFF );
+
+    const uint8_t * b = (const uint8_t *)body;
+    for( size_t i = 0; i < len; i++ )
+        p[MOCK_RECORD_HEADER + i] = (char)( b[i] ^ MOCK_RECORD_KEY );
+}
+
+static void mock_record_decode( std::string & body )
+{
+    for( size_t i = 0; i < body.size(); i++ )
+        body[i] = (char)( body[i] ^ MOCK_RECORD_KEY );
+}
+
+// 1: a whole record, otherwise the result of the read callback
+static int mock_read_record( MSSPI_HANDLE h, uint8_t * type, std::string & body )
+{
+    while( h->rec.size() < MOCK_RECORD_HEADER )
+    {
+        char header[MOCK_RECORD_HEADER];
+        int ret = h->read_cb( h->arg, header, (int)( MOCK_RECORD_HEADER - h->rec.size() ) );
+        if( ret <= 0 )
+            return ret;
+        h->rec.append( header, (size_t)ret );
+    }
+
+    size_t len = ( (size_t)(uint8_t)h->rec[3] << 8 ) | (uint8_t)h->rec[4];
+    size_t total = MOCK_RECORD_HEADER + len;
+
+    while( h->rec.size() < total )
+    {
+        size_t have = h->rec.size();
+        h->rec.resize( total );
+        int ret = h->read_cb( h->arg, &h->rec[have], (int)( total - have ) );
+        h->rec.resize( have + ( ret > 0 ? (size_t)ret : 0 ) );
+        if( ret <= 0 )
+            return ret;
+    }
+
+    *type = (uint8_t)h->rec[0];
+    body.assign( h->rec, MOCK_RECORD_HEADER, len );
+    mock_record_decode( body );
+    h->rec.clear();
+    return 1;
+}
+
+static bool mock_write_record( MSSPI_HANDLE h, uint8_t type, const void * body, size_t len )
+{
+    h->wrec.clear();
+    mock_record_append( h->wrec, type, body, len );
+    return h->write_cb( h->arg, h->wrec.data(), (int)h->wrec.size() ) == (int)h->wrec.size();
+}
+
+MSSPI_HANDLE msspi_open( void * cb_arg, msspi_read_cb read_cb, msspi_write_cb write_cb )
+{
+    MSSPI_HANDLE h = new MSSPI();
+
+    h->arg = cb_arg;
+    h->read_cb = read_cb;
+    h->write_cb = write_cb;
+    h->cert_cb = NULL;
+    h->state = 0;
+    h->hello_sent = false;
+    h->hello_received = false;
+    h->cert_requested = false;
+    h->cert_sent = false;
+    h->connected = false;
+    h->plain_pos = 0;
+    memset( &h->cipher_info, 0, sizeof( h->cipher_info ) );
+    return h;
+}
+
+void msspi_close( MSSPI_HANDLE h )
+{
+    delete h;
+}
+
+char msspi_set_hostname( MSSPI_HANDLE h, const char * hostname )
+{
+    h->hostname = hostname;
+    return 1;
+}
+
+char msspi_set_cachestring( MSSPI_HANDLE h, const char * cachestring )
+{
+    h->cachestring = cachestring;
+    return 1;
+}
+
+char msspi_set_alpn( MSSPI_HANDLE /* h */, const unsigned char * /* alpn */, unsigned /* len */ )
+{
+    return 1;
+}
+
+char msspi_set_mycert( MSSPI_HANDLE h, const char * clientCert, int len )
+{
+    h->mycert.assign( clientCert, (size_t)len );
+    return 1;
+}
+
+void msspi_set_cert_cb( MSSPI_HANDLE h, msspi_cert_cb cert_cb )
+{
+    h->cert_cb = cert_cb;
+}
+
+int msspi_connect( MSSPI_HANDLE h )
+{
+    if( h->connected )
+        return 1;
+
+    if( !h->hello_sent )
+    {
+        if( !mock_write_record( h, MOCK_RECORD_HANDSHAKE, h->hostname.data(), h->hostname.size() ) )
+        {
+            h->state = MSSPI_WRITING | MSSPI_LAST_PROC_WRITE;
+            return -1;
+        }
+
+        h->hello_sent = true;
+    }
+
+    if( !h->hello_received )
+    {
+        uint8_t type;
+        std::string body;
+        int ret = mock_read_record( h, &type, body );
+
+        if( ret <= 0 )
+        {
+            h->state = ret < 0 ? MSSPI_READING : MSSPI_ERROR;
+            return ret < 0 ? -1 : 0;
+        }
+
+        if( type != MOCK_RECORD_HANDSHAKE || body.size() < 7 )
+        {
+            h->state = MSSPI_ERROR;
+            return 0;
+        }
+
+        const uint8_t * p = (const uint8_t *)body.data();
+
+        h->cipher_info.dwCipherSuite = ( (DWORD)p[0] << 8 ) | p[1];
+        h->cipher_info.dwProtocol = ( (DWORD)p[2] << 24 ) | ( (DWORD)p[3] << 16 ) | ( (DWORD)p[4] << 8 ) | p[5];
+        h->cert_requested = p[6] != 0;
+        h->peercert.assign( body, 7, std::string::npos );
+        h->hello_received = true;
+    }
+
+    if( h->cert_requested )
+    {
+        if( !h->cert_sent )
+        {
+            // the application picks a certificate (msspi_set_mycert) or declines, or asks to retry
+            if( h->cert_cb && h->cert_cb( h->arg ) <= 0 )
+            {
+                h->state = MSSPI_X509_LOOKUP;
+                return -1;
+            }
+
+            if( !mock_write_record( h, MOCK_RECORD_HANDSHAKE, h->mycert.data(), h->mycert.size() ) )
+            {
+                h->state = MSSPI_WRITING | MSSPI_LAST_PROC_WRITE;
+                return -1;
+            }
+
+            h->cert_sent = true;
+        }
+
+        // accepted: a handshake record, rejected: an alert
+        uint8_t type;
+        std::string body;
+        int ret = mock_read_record( h, &type, body );
+
+        if( ret <= 0 )
+        {
+            h->state = ret < 0 ? MSSPI_READING : MSSPI_ERROR;
+            return ret < 0 ? -1 : 0;
+        }
+
+        if( type != MOCK_RECORD_HANDSHAKE )
+        {
+            h->state = MSSPI_ERROR;
+            return 0;
+        }
+
+        h->cert_requested = false;
+    }
+
+    h->connected = true;
+    h->state = 0;
+    return 1;
+}
+
+static int mock_fill( MSSPI_HANDLE h )
+{
+    while( h->plain_pos == h->plain.size() )
+    {
+        uint8_t type;
+        int ret = mock_read_record( h, &type, h->plain );
+
+        if( ret <= 0 )
+        {
+            h->plain.clear();
+            h->plain_pos = 0;
+            h->state = ret < 0 ? MSSPI_READING : MSSPI_RECEIVED_SHUTDOWN;
+            return ret < 0 ? -1 : 0;
+        }
+
+        h->plain_pos = 0;
+
+        if( type == MOCK_RECORD_ALERT )
+        {
+            h->plain.clear();
+            h->state = MSSPI_RECEIVED_SHUTDOWN;
+            return 0;
+        }
+
+        if( type != MOCK_RECORD_DATA )
+            h->plain.clear();
+    }
+
+    return 1;
+}
+
+int msspi_read( MSSPI_HANDLE h, void * buf, int len )
+{
+    int ret = mock_fill( h );
+    if( ret <= 0 )
+        return ret;
+
+    size_t n = h->plain.size() - h->plain_pos;
+    if( n > (size_t)len )
+        n = (size_t)len;
+
+    memcpy( buf, h->plain.data() + h->plain_pos, n );
+    h->plain_pos += n;
+    h->state = 0;
+    return (int)n;
+}
+
+int msspi_peek( MSSPI_HANDLE h, void * buf, int len )
+{
+    int ret = mock_fill( h );
+    if( ret <= 0 )
+        return ret;
+
+    size_t n = h->plain.size() - h->plain_pos;
+    if( n > (size_t)len )
+        n = (size_t)len;
+
+    memcpy( buf, h->plain.data() + h->plain_pos, n );
+    h->state = 0;
+    return (int)n;
+}
+
+int msspi_write( MSSPI_HANDLE h, const void * buf, int len )
+{
+    const char * p = (const char *)buf;
+    size_t left = (size_t)len;
+
+    while( left )
+    {
+        size_t n = left < MOCK_RECORD_MAX ? left : MOCK_RECORD_MAX;
+
+        if( !mock_write_record( h, MOCK_RECORD_DATA, p, n ) )
+        {
+            h->state = MSSPI_WRITING | MSSPI_LAST_PROC_WRITE;
+            return left == (size_t)len ? -1 : len - (int)left;
+        }
+
+        p += n;
+        left -= n;
+    }
+
+    h->state = 0;
+    return len;
+}
+
+int msspi_state( MSSPI_HANDLE h )
+{
+    return h->state;
+}
+
+const char * msspi_get_alpn( MSSPI_HANDLE /* h */ )
+{
+    return "http/1.1";
+}
+
+PSecPkgContext_CipherInfo msspi_get_cipherinfo( MSSPI_HANDLE h )
+{
+    return h->connected ? &h->cipher_info : NULL;
+}
+
+char msspi_get_peercerts( MSSPI_HANDLE h, const char ** bufs, int * lens, size_t * count )
+{
+    if( !h->connected )
+        return 0;
+
+    if( bufs )
+    {
+        bufs[0] = h->peercert.data();
+        lens[0] = (int)h->peercert.size();
+    }
+
+    *count = 1;
+    return 1;
+}
+
+char msspi_get_issuerlist( MSSPI_HANDLE /* h */, const char ** bufs, int * lens, size_t * count )
+{
+    static const char issuer[] = "Mock CA";
+
+    if( bufs )
+    {
+        bufs[0] = issuer;
+        lens[0] = (int)sizeof( issuer ) - 1;
+    }
+
+    *count = 1;
+    return 1;
+}
+
+unsigned msspi_verify( MSSPI_HANDLE /* h */ )
+{
+    return MSSPI_VERIFY_OK;
+}
+
+/* Server end */
+
+void mock_peer_pump( MOCK_PEER & peer )
+{
+    GLUE_PIPE & in = *peer.in;
+
+    for( ;; )
+    {
+        size_t avail = in.data.size() - in.pos;
+
+        if( avail < MOCK_RECORD_HEADER )
+            break;
+
+        const uint8_t * p = (const uint8_t *)in.data.data() + in.pos;
+        size_t len = ( (size_t)p[3] << 8 ) | p[4];
+
+        if( avail < MOCK_RECORD_HEADER + len )
+            break;
+
+        if( p[0] == MOCK_RECORD_HANDSHAKE )
+        {
+            std::string body( (const char *)p + MOCK_RECORD_HEADER, len );
+            mock_record_decode( body );
+
+            // the client certificate after the hello of this connection
+            if( peer.request_cert && peer.hellos )
+            {
+                static const uint8_t alert[2] = { 2, 42 }; // fatal, bad_certificate
+
+                peer.client_cert = body;
+
+                if( peer.reject_cert )
+                    mock_record_append( peer.out->data, MOCK_RECORD_ALERT, alert, sizeof( alert ) );
+                else
+                    mock_record_append( peer.out->data, MOCK_RECORD_HANDSHAKE, NULL, 0 );
+
+                in.pos += MOCK_RECORD_HEADER + len;
+                continue;
+            }
+
+            peer.hellos++;
+
+            if( peer.fail || body.compare( 0, 5, "fail." ) == 0 )
+            {
+                static const uint8_t alert[2] = { 2, 40 }; // fatal, handshake_failure
+                mock_record_append( peer.out->data, MOCK_RECORD_ALERT, alert, sizeof( alert ) );
+            }
+            else
+            {
+                std::string hello;
+                hello += (char)( peer.cipher >> 8 );
+                hello += (char)( peer.cipher & 0xFF );
+                for( int shift = 24; shift >= 0; shift -= 8 )
+                    hello += (char)( ( peer.protocol >> shift ) & 0xFF );
+                hello += (char)( peer.request_cert ? 1 : 0 );
+                hello += peer.cert;
+                mock_record_append( peer.out->data, MOCK_RECORD_HANDSHAKE, hello.data(), hello.size() );
+            }
+        }
+        else if( p[0] == MOCK_RECORD_DATA )
+            peer.received += len;
+
+        in.pos += MOCK_RECORD_HEADER + len;
+    }
+
+    if( in.pos == in.data.size() )
+    {
+        in.data.clear();
+        in.pos = 0;
+    }
+    else if( in.pos > MOCK_RECORD_MAX )
+    {
+        in.data.erase( 0, in.pos );
+        in.pos = 0;
+    }
+}
+
+void mock_peer_send( MOCK_PEER & peer, size_t bytes, size_t record )
+{
+    static const std::string payload( MOCK_RECORD_MAX, 'x' );
+
+    if( record > MOCK_RECORD_MAX )
+        record = MOCK_RECORD_MAX;
+
+    while( bytes )
+    {
+        size_t n = bytes < record ? bytes : record;
+        mock_record_append( peer.out->data, MOCK_RECORD_DATA, payload.data(), n );
+        bytes -= n;
+    }
+}
@@ -27,11 +27,19 @@ void gostssl_free( SSL * s );
 // Markers
 int gostssl_tls_gost_required( SSL * s );
 
+// Statistics
+int gostssl_get_stats( const char ** names, uint64_t * values, int count );
+void gostssl_set_histogram_cb( void ( * cb )( const char * name, uint64_t sample, int is_count ) );
+
 // Hooks
-void gostssl_certhook( void * cert, int size );
-void gostssl_verifyhook( void * s, unsigned * is_gost );
+void gostssl_certhook( void * s, void * cert, int size );
+void gostssl_verifychainhook( const char * host, const char ** certs, const int * lens, size_t count, unsigned * gost_status );
 void gostssl_clientcertshook( char *** certs, int ** lens, wchar_t *** names, int * count, int * is_gost );
 void gostssl_isgostcerthook( void * cert, int size, int * is_gost );
+void gostssl_certdbchangedhook();
+void gostssl_warmuphook();
+void gostssl_datadirhook( void * cachestring, size_t len, const char * dir );
+void gostssl_gostfirsthook( int enabled );
 
 }
 
@@ -46,22 +54,260 @@ void gostssl_isgostcerthook( void * cert, int size, int * is_gost );
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
 #define _SILENCE_STDEXT_HASH_DEPRECATION_WARNINGS
 #include <map>
+#include <set>
 #include <unordered_map>
 #include <string>
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include <openssl/rand.h>
 
 #include "msspi.h"
 
 #define TLS_GOST_CIPHER_2001 0x0081
 #define TLS_GOST_CIPHER_2012 0xFF85
 
+/* RFC 9367: TLS 1.3 GOST ciphersuites (KUZNYECHIK/MAGMA MGM, L and S variants) */
+#define TLS_GOST_CIPHER_KUZNYECHIK_MGM_L 0xC103
+#define TLS_GOST_CIPHER_MAGMA_MGM_L 0xC104
+#define TLS_GOST_CIPHER_KUZNYECHIK_MGM_S 0xC105
+#define TLS_GOST_CIPHER_MAGMA_MGM_S 0xC106
+
+static bool is_gost_cipher( uint16_t cipher_id )
+{
+    switch( cipher_id )
+    {
+        case TLS_GOST_CIPHER_2001:
+        case TLS_GOST_CIPHER_2012:
+        case TLS_GOST_CIPHER_KUZNYECHIK_MGM_L:
+        case TLS_GOST_CIPHER_MAGMA_MGM_L:
+        case TLS_GOST_CIPHER_KUZNYECHIK_MGM_S:
+        case TLS_GOST_CIPHER_MAGMA_MGM_S:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/* Statistics: relaxed atomic counters, durations are also reported as histogram samples,
+   counters as their increase over each GOSTSSL_STATS_REPORT interval */
+
+typedef enum
+{
+    GOSTSSL_STAT_INIT_US,
+    GOSTSSL_STAT_INIT_BACKGROUND,
+    GOSTSSL_STAT_WORKERS_LIVE,
+    GOSTSSL_STAT_WORKERS_CREATED,
+    GOSTSSL_STAT_MSSPI_OPENED,
+    GOSTSSL_STAT_HOST_HITS,
+    GOSTSSL_STAT_HOST_MISSES,
+    GOSTSSL_STAT_HOST_EVICTIONS,
+    GOSTSSL_STAT_GOST_REQUIRED,
+    GOSTSSL_STAT_PROBES_FAILED,
+    GOSTSSL_STAT_PROBES_SAVED,
+    GOSTSSL_STAT_HANDSHAKES,
+    GOSTSSL_STAT_HANDSHAKE_US,
+    GOSTSSL_STAT_VERIFY_US,
+    GOSTSSL_STAT_CLIENTCERTS_LOOKUPS,
+    GOSTSSL_STAT_CLIENTCERTS_US,
+    GOSTSSL_STAT_BYTES_READ,
+    GOSTSSL_STAT_BYTES_WRITTEN,
+    GOSTSSL_STAT_RECORDS_READ,
+    GOSTSSL_STAT_RECORDS_WRITTEN,
+    GOSTSSL_STAT_BIO_READS,
+    GOSTSSL_STAT_BIO_WRITES,
+    GOSTSSL_STAT_GMUTEX_WAITS,
+    GOSTSSL_STAT_GMUTEX_WAIT_US,
+    GOSTSSL_STAT_FILES_LOADED,
+    GOSTSSL_STAT_COUNT
+}
+GOSTSSL_STAT;
+
+static const char * gostssl_stat_names[GOSTSSL_STAT_COUNT] =
+{
+    "init_us",
+    "init_background",
+    "workers_live",
+    "workers_created",
+    "msspi_opened",
+    "host_status_hits",
+    "host_status_misses",
+    "host_status_evictions",
+    "gost_required",
+    "probes_failed",
+    "probes_saved",
+    "handshakes",
+    "handshake_us",
+    "verify_us",
+    "clientcerts_lookups",
+    "clientcerts_us",
+    "bytes_read",
+    "bytes_written",
+    "records_read",
+    "records_written",
+    "bio_reads",
+    "bio_writes",
+    "gmutex_waits",
+    "gmutex_wait_us",
+    "files_loaded",
+};
+
+#define GOSTSSL_STATS_REPORT ( 60 * 1000 * 1000 ) // us between counter reports
+
+typedef void ( * GOSTSSL_HISTOGRAM_CB )( const char * name, uint64_t sample, int is_count );
+
+static std::atomic<uint64_t> gostssl_stats[GOSTSSL_STAT_COUNT];
+static std::atomic<GOSTSSL_HISTOGRAM_CB> gostssl_histogram_cb( NULL );
+static std::atomic<uint64_t> gostssl_stats_reported( 0 ); // when counters were last reported
+static uint64_t gostssl_stats_last[GOSTSSL_STAT_COUNT]; // values reported then, owned by the reporter
+static std::string * gostssl_stats_histograms = new std::string[GOSTSSL_STAT_COUNT]; // names, owned by the reporter
+
+static void stat_add( GOSTSSL_STAT stat, uint64_t value = 1 )
+{
+    gostssl_stats[stat].fetch_add( value, std::memory_order_relaxed );
+}
+
+static uint64_t stat_now_us()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+static void stat_histogram( const char * name, uint64_t sample_us )
+{
+    GOSTSSL_HISTOGRAM_CB cb = gostssl_histogram_cb.load( std::memory_order_acquire );
+    if( cb )
+        cb( name, sample_us, 0 );
+}
+
+// durations are reported per sample by stat_histogram, the rest here
+static bool stat_is_counter( int stat )
+{
+    switch( stat )
+    {
+        case GOSTSSL_STAT_INIT_US:
+        case GOSTSSL_STAT_INIT_BACKGROUND:
+        case GOSTSSL_STAT_HANDSHAKE_US:
+        case GOSTSSL_STAT_VERIFY_US:
+        case GOSTSSL_STAT_CLIENTCERTS_US:
+        case GOSTSSL_STAT_GMUTEX_WAIT_US:
+            return false;
+
+        default:
+            return true;
+    }
+}
+
+// "Net.GostSSL.Count.<name>": the increase of every counter since the last report,
+// workers_live as is; one caller per interval reports, the others return at once
+static void stat_report()
+{
+    GOSTSSL_HISTOGRAM_CB cb = gostssl_histogram_cb.load( std::memory_order_acquire );
+    if( !cb )
+        return;
+
+    uint64_t now = stat_now_us();
+    uint64_t reported = gostssl_stats_reported.load( std::memory_order_relaxed );
+
+    if( reported && now - reported < GOSTSSL_STATS_REPORT )
+        return;
+
+    if( !gostssl_stats_reported.compare_exchange_strong( reported, now, std::memory_order_relaxed ) )
+        return;
+
+    for( int i = 0; i < GOSTSSL_STAT_COUNT; i++ )
+    {
+        if( !stat_is_counter( i ) )
+            continue;
+
+        std::string & name = gostssl_stats_histograms[i];
+        if( name.empty() )
+            name = std::string( "Net.GostSSL.Count." ) + gostssl_stat_names[i];
+
+        uint64_t value = gostssl_stats[i].load( std::memory_order_relaxed );
+
+        if( i == GOSTSSL_STAT_WORKERS_LIVE )
+            cb( name.c_str(), value, 1 );
+        else
+        {
+            cb( name.c_str(), value - gostssl_stats_last[i], 1 );
+            gostssl_stats_last[i] = value;
+        }
+    }
+}
+
+int gostssl_get_stats( const char ** names, uint64_t * values, int count )
+{
+    if( !names || !values )
+        return GOSTSSL_STAT_COUNT;
+
+    if( count > GOSTSSL_STAT_COUNT )
+        count = GOSTSSL_STAT_COUNT;
+
+    for( int i = 0; i < count; i++ )
+    {
+        names[i] = gostssl_stat_names[i];
+        values[i] = gostssl_stats[i].load( std::memory_order_relaxed );
+    }
+
+    return count;
+}
+
+void gostssl_set_histogram_cb( void ( * cb )( const char * name, uint64_t sample, int is_count ) )
+{
+    gostssl_histogram_cb.store( cb, std::memory_order_release );
+}
+
 static const SSL_CIPHER * tlsgost2001 = NULL;
 static const SSL_CIPHER * tlsgost2012 = NULL;
+static int gostssl_ex_index = -1;
+static std::atomic<bool> gostssl_gost_first( false ); // hosts of unknown status try msspi first
+static uint64_t host_statuses_secret[2]; // SipHash key of host keys, random per process
+
+static void clientcerts_prefetch();
+
+static thread_local bool gostssl_warmup_thread = false;
+
+static int gostssl_init_impl();
 
 int gostssl_init()
+{
+    uint64_t start = stat_now_us();
+    int ret = gostssl_init_impl();
+    uint64_t init_us = stat_now_us() - start;
+
+    gostssl_stats[GOSTSSL_STAT_INIT_US].store( init_us, std::memory_order_relaxed );
+    gostssl_stats[GOSTSSL_STAT_INIT_BACKGROUND].store( gostssl_warmup_thread ? 1 : 0, std::memory_order_relaxed );
+    stat_histogram( "Net.GostSSL.InitTime", init_us );
+    return ret;
+}
+
+// GOST-first mode (serial: msspi, then BoringSSL on failure), set by the embedder before connections
+void gostssl_gostfirsthook( int enabled )
+{
+    gostssl_gost_first.store( enabled != 0, std::memory_order_relaxed );
+}
+
+// load and initialize the CSP before the first connection needs it
+void gostssl_warmuphook()
+{
+    std::thread( []()
+    {
+        gostssl_warmup_thread = true;
+        gostssl();
+    } ).detach();
+}
+
+static int gostssl_init_impl()
 {
     MSSPI_HANDLE h = msspi_open( NULL, (msspi_read_cb)(uintptr_t)1, (msspi_write_cb)(uintptr_t)1 );
     if( !h )
@@ -82,6 +328,16 @@ int gostssl_init()
     if( !tlsgost2001 || !tlsgost2012 )
         return 0;
 
+    gostssl_ex_index = boring_SSL_get_ex_new_index();
+
+    if( gostssl_ex_index < 0 )
+        return 0;
+
+    if( !RAND_bytes( (uint8_t *)host_statuses_secret, sizeof( host_statuses_secret ) ) )
+        return 0;
+
+    clientcerts_prefetch();
+
     return 1;
 }
 
@@ -90,52 +346,154 @@ typedef enum
     GOSTSSL_HOST_AUTO = 0,
     GOSTSSL_HOST_YES = 1,
     GOSTSSL_HOST_NO = 2,
-    GOSTSSL_HOST_PROBING = 16,
-    GOSTSSL_HOST_PROBING_END = 31
+    GOSTSSL_HOST_SPECULATIVE = 3,
+    GOSTSSL_HOST_PROBING = 16
 }
 GOSTSSL_HOST_STATUS;
 
+// a network context (cachestring), shared by its connections and never freed
+struct GOSTSSL_CONTEXT
+{
+    std::string cachestring; // hex, as in host keys and msspi session caches
+};
+
+struct GostSSL_Worker;
+static void verify_pending_set( GostSSL_Worker * w, bool pending );
+
 struct GostSSL_Worker
 {
     GostSSL_Worker()
     {
         h = NULL;
         s = NULL;
+        context = NULL;
+        cert = NULL;
         host_status = GOSTSSL_HOST_AUTO;
+        wcoalesce = false;
+        wpend_ret = 0;
+        connect_us = 0;
+        verify_retry = false;
+        client_auth = false;
+        stat_add( GOSTSSL_STAT_WORKERS_LIVE );
+        stat_add( GOSTSSL_STAT_WORKERS_CREATED );
     }
 
     ~GostSSL_Worker()
     {
+        gostssl_stats[GOSTSSL_STAT_WORKERS_LIVE].fetch_sub( 1, std::memory_order_relaxed );
         if( h )
             msspi_close( h );
+        if( cert )
+            CertFreeCertificateContext( cert );
+        verify_pending_set( this, false );
     }
 
-    MSSPI_HANDLE h;
+    MSSPI_HANDLE h; // opened on demand, only for connections that go through msspi
     SSL * s;
+    PCCERT_CONTEXT cert; // client certificate selected for this connection
+    std::string wbuf; // records produced by one gostssl_write, flushed at once
+    bool wcoalesce;
+    int wpend_ret; // result of a gostssl_write waiting for its records to be flushed
+    uint64_t connect_us; // time spent in msspi_connect during the handshake
+    bool verify_retry; // msspi handshake is done, the server certificate is still being verified
+    std::string verify_key; // host and leaf of the msspi handshake being verified, empty otherwise
+    bool client_auth; // the server asked for a client certificate: it speaks GOST
     GOSTSSL_HOST_STATUS host_status;
     std::string host_string;
+    GOSTSSL_CONTEXT * context;
 };
 
+// msspi handshakes waiting for the certificate verifier, by host and leaf certificate
+static std::mutex & verify_pending_mutex = *( new std::mutex() );
+static std::multiset< std::string > & verify_pending = *( new std::multiset< std::string >() );
+
+static void verify_pending_set( GostSSL_Worker * w, bool pending )
+{
+    if( w->verify_key.empty() )
+        return;
+
+    std::unique_lock<std::mutex> lck( verify_pending_mutex );
+
+    if( pending )
+    {
+        verify_pending.insert( w->verify_key );
+        return;
+    }
+
+    std::multiset< std::string >::iterator it = verify_pending.find( w->verify_key );
+    if( it != verify_pending.end() )
+        verify_pending.erase( it );
+    w->verify_key.clear();
+}
+
+static bool verify_pending_find( const std::string & key )
+{
+    std::unique_lock<std::mutex> lck( verify_pending_mutex );
+    return verify_pending.find( key ) != verify_pending.end();
+}
+
 static int gostssl_read_cb( GostSSL_Worker * w, void * buf, int len )
 {
+    stat_add( GOSTSSL_STAT_BIO_READS );
     return boring_BIO_read( w->s, buf, len );
 }
 
+#define GOSTSSL_WBUF_KEEP ( 64 * 1024 )
+
+// returns true when every coalesced record reached the BIO
+static bool gostssl_flush( GostSSL_Worker * w )
+{
+    size_t done = 0;
+
+    while( done < w->wbuf.size() )
+    {
+        stat_add( GOSTSSL_STAT_BIO_WRITES );
+        int ret = boring_BIO_write( w->s, w->wbuf.data() + done, (int)( w->wbuf.size() - done ) );
+        if( ret <= 0 )
+            break;
+        done += (size_t)ret;
+    }
+
+    w->wbuf.erase( 0, done );
+
+    if( w->wbuf.empty() && w->wbuf.capacity() > GOSTSSL_WBUF_KEEP )
+        std::string().swap( w->wbuf );
+
+    return w->wbuf.empty();
+}
+
 static int gostssl_write_cb( GostSSL_Worker * w, const void * buf, int len )
 {
+    stat_add( GOSTSSL_STAT_RECORDS_WRITTEN );
+
+    if( w->wcoalesce )
+    {
+        w->wbuf.append( (const char *)buf, (size_t)len );
+        return len;
+    }
+
+    // handshake or alert record behind coalesced ones: queue it in order, push out what fits
+    if( !w->wbuf.empty() )
+    {
+        w->wbuf.append( (const char *)buf, (size_t)len );
+        gostssl_flush( w );
+        return len;
+    }
+
+    stat_add( GOSTSSL_STAT_BIO_WRITES );
     return boring_BIO_write( w->s, buf, len );
 }
 
-static PCCERT_CONTEXT gcert = NULL;
-
 static int gostssl_cert_cb( GostSSL_Worker * w )
 {
+    w->client_auth = true;
+
     if( w->s->config->cert && w->s->config->cert->cert_cb )
     {
-        if( gcert )
+        if( w->cert )
         {
-            CertFreeCertificateContext( gcert );
-            gcert = NULL;
+            CertFreeCertificateContext( w->cert );
+            w->cert = NULL;
         }
 
         // mimic ssl3_get_certificate_request
@@ -157,228 +515,1282 @@ static int gostssl_cert_cb( GostSSL_Worker * w )
 
         int ret = w->s->config->cert->cert_cb( w->s, w->s->config->cert->cert_cb_arg );
 
-        if( !gcert )
+        if( !w->cert )
         {
             if( ret <= 0 )
                 return ret;
         }
 
-        if( gcert )
+        if( w->cert )
         {
-            if( msspi_set_mycert( w->h, (const char *)gcert->pbCertEncoded, gcert->cbCertEncoded ) )
+            if( msspi_set_mycert( w->h, (const char *)w->cert->pbCertEncoded, w->cert->cbCertEncoded ) )
                 boring_ERR_clear_error();
 
-            CertFreeCertificateContext( gcert );
-            gcert = NULL;
+            CertFreeCertificateContext( w->cert );
+            w->cert = NULL;
         }
     }
 
     return 1;
 }
 
-void gostssl_certhook( void * cert, int size )
+/* Minimal bounds-checked DER reader, no allocations */
+
+struct DER_SPAN
 {
-    if( !cert )
-        return;
+    const uint8_t * p;
+    const uint8_t * end;
+};
 
-    if( gcert )
-        return;
+// reads the next element with the expected tag, returns its contents
+static bool der_next( DER_SPAN & span, uint8_t tag, DER_SPAN * content )
+{
+    if( span.end - span.p < 2 || span.p[0] != tag )
+        return false;
 
-    if( size == 0 )
-        gcert = CertDuplicateCertificateContext( (PCCERT_CONTEXT)cert );
-    else
-        gcert = CertCreateCertificateContext( X509_ASN_ENCODING, (BYTE *)cert, size );
+    const uint8_t * p = span.p + 1;
+    size_t len = *p++;
+
+    if( len & 0x80 )
+    {
+        size_t octets = len & 0x7F;
+
+        if( octets == 0 || octets > 4 || (size_t)( span.end - p ) < octets )
+            return false;
+
+        len = 0;
+        while( octets-- )
+            len = ( len << 8 ) | *p++;
+    }
+
+    if( (size_t)( span.end - p ) < len )
+        return false;
+
+    if( content )
+    {
+        content->p = p;
+        content->end = p + len;
+    }
+
+    span.p = p + len;
+    return true;
+}
+
+#define DER_SEQUENCE 0x30
+#define DER_INTEGER 0x02
+#define DER_OID 0x06
+#define DER_CONTEXT_0 0xA0
+
+// Certificate ::= SEQUENCE { tbsCertificate, signatureAlgorithm SEQUENCE { algorithm OID, ... }, ... }
+static bool der_cert_signature_oid( const uint8_t * cert, size_t len, DER_SPAN * oid )
+{
+    DER_SPAN span = { cert, cert + len };
+    DER_SPAN certificate;
+    DER_SPAN algorithm;
+
+    return der_next( span, DER_SEQUENCE, &certificate ) &&
+           der_next( certificate, DER_SEQUENCE, NULL ) &&
+           der_next( certificate, DER_SEQUENCE, &algorithm ) &&
+           der_next( algorithm, DER_OID, oid );
+}
+
+// TBSCertificate ::= SEQUENCE { [0] version OPTIONAL, serialNumber, signature, issuer, validity, subject,
+//                              subjectPublicKeyInfo SEQUENCE { algorithm SEQUENCE { algorithm OID, ... }, ... }, ... }
+static bool der_cert_spki_oid( const uint8_t * cert, size_t len, DER_SPAN * oid )
+{
+    DER_SPAN span = { cert, cert + len };
+    DER_SPAN certificate;
+    DER_SPAN tbs;
+    DER_SPAN spki;
+    DER_SPAN algorithm;
+
+    if( !der_next( span, DER_SEQUENCE, &certificate ) ||
+        !der_next( certificate, DER_SEQUENCE, &tbs ) )
+        return false;
+
+    if( tbs.p < tbs.end && tbs.p[0] == DER_CONTEXT_0 && !der_next( tbs, DER_CONTEXT_0, NULL ) )
+        return false;
+
+    return der_next( tbs, DER_INTEGER, NULL ) &&
+           der_next( tbs, DER_SEQUENCE, NULL ) &&
+           der_next( tbs, DER_SEQUENCE, NULL ) &&
+           der_next( tbs, DER_SEQUENCE, NULL ) &&
+           der_next( tbs, DER_SEQUENCE, NULL ) &&
+           der_next( tbs, DER_SEQUENCE, &spki ) &&
+           der_next( spki, DER_SEQUENCE, &algorithm ) &&
+           der_next( algorithm, DER_OID, oid );
+}
+
+struct DER_OID_BYTES
+{
+    const uint8_t * bytes;
+    size_t len;
+};
+
+static bool der_oid_in( const DER_SPAN & oid, const DER_OID_BYTES * oids, size_t count )
+{
+    size_t len = (size_t)( oid.end - oid.p );
+
+    for( size_t i = 0; i < count; i++ )
+        if( oids[i].len == len && 0 == memcmp( oids[i].bytes, oid.p, len ) )
+            return true;
+
+    return false;
 }
 
+static const uint8_t oid_gost_r3411_r3410el[] = { 0x2A, 0x85, 0x03, 0x02, 0x02, 0x03 }; // szOID_CP_GOST_R3411_R3410EL
+static const uint8_t oid_gost_r3411_12_256_r3410[] = { 0x2A, 0x85, 0x03, 0x07, 0x01, 0x01, 0x03, 0x02 }; // szOID_CP_GOST_R3411_12_256_R3410
+static const uint8_t oid_gost_r3411_12_512_r3410[] = { 0x2A, 0x85, 0x03, 0x07, 0x01, 0x01, 0x03, 0x03 }; // szOID_CP_GOST_R3411_12_512_R3410
+
+static const DER_OID_BYTES gost_signature_oids[] =
+{
+    { oid_gost_r3411_r3410el, sizeof( oid_gost_r3411_r3410el ) },
+    { oid_gost_r3411_12_256_r3410, sizeof( oid_gost_r3411_12_256_r3410 ) },
+    { oid_gost_r3411_12_512_r3410, sizeof( oid_gost_r3411_12_512_r3410 ) },
+};
+
+static const uint8_t oid_gost_r3410el[] = { 0x2A, 0x85, 0x03, 0x02, 0x02, 0x13 }; // szOID_CP_GOST_R3410EL
+static const uint8_t oid_gost_r3410_12_256[] = { 0x2A, 0x85, 0x03, 0x07, 0x01, 0x01, 0x01, 0x01 }; // szOID_CP_GOST_R3410_12_256
+static const uint8_t oid_gost_r3410_12_512[] = { 0x2A, 0x85, 0x03, 0x07, 0x01, 0x01, 0x01, 0x02 }; // szOID_CP_GOST_R3410_12_512
+
+static const DER_OID_BYTES gost2001_key_oids[] =
+{
+    { oid_gost_r3410el, sizeof( oid_gost_r3410el ) },
+};
+
+static const DER_OID_BYTES gost2012_key_oids[] =
+{
+    { oid_gost_r3410_12_256, sizeof( oid_gost_r3410_12_256 ) },
+    { oid_gost_r3410_12_512, sizeof( oid_gost_r3410_12_512 ) },
+};
+
 void gostssl_isgostcerthook( void * cert, int size, int * is_gost )
 {
-    PCCERT_CONTEXT certctx = NULL;
+    const uint8_t * der = (const uint8_t *)cert;
+    size_t len = (size_t)size;
+    DER_SPAN oid;
 
     *is_gost = 0;
 
-    if( size == 0 )
-        certctx = CertDuplicateCertificateContext( (PCCERT_CONTEXT)cert );
-    else
-        certctx = CertCreateCertificateContext( X509_ASN_ENCODING, (BYTE *)cert, size );
-
-    if( !certctx || !certctx->pCertInfo || !certctx->pCertInfo->SignatureAlgorithm.pszObjId )
+    if( !cert )
         return;
 
-    LPSTR pszObjId = certctx->pCertInfo->SignatureAlgorithm.pszObjId;
+    if( size == 0 )
+    {
+        der = ( (PCCERT_CONTEXT)cert )->pbCertEncoded;
+        len = ( (PCCERT_CONTEXT)cert )->cbCertEncoded;
+    }
 
-    if( 0 == strcmp( pszObjId, szOID_CP_GOST_R3411_R3410EL ) ||
-        0 == strcmp( pszObjId, szOID_CP_GOST_R3411_12_256_R3410 ) ||
-        0 == strcmp( pszObjId, szOID_CP_GOST_R3411_12_512_R3410 ) )
+    if( der_cert_signature_oid( der, len, &oid ) &&
+        der_oid_in( oid, gost_signature_oids, sizeof( gost_signature_oids ) / sizeof( gost_signature_oids[0] ) ) )
         *is_gost = 1;
-
-    CertFreeCertificateContext( certctx );
-    return;
 }
 
-typedef std::map< void *, GostSSL_Worker * > WORKERS_DB;
-typedef std::unordered_map< std::string, GOSTSSL_HOST_STATUS > HOST_STATUSES_DB;
-typedef std::pair< std::string, GOSTSSL_HOST_STATUS > HOST_STATUSES_DB_PAIR;
+/* Host statuses: bounded set-associative cache, lock-free reads (seqlock per entry), CLOCK eviction */
 
-static WORKERS_DB & workers_db = *( new WORKERS_DB() );
-static HOST_STATUSES_DB & host_statuses_db = *( new HOST_STATUSES_DB() );
-static std::recursive_mutex & gmutex = *( new std::recursive_mutex() );
+#define HOST_STATUSES_SETS 256
+#define HOST_STATUSES_WAYS 8
+#define HOST_STATUSES_TTL ( 60 * 60 )
+#define HOST_STATUSES_TTL_FINAL ( 12 * 60 * 60 )
 
-static void host_status_set( std::string & site, GOSTSSL_HOST_STATUS status )
+struct HOST_STATUSES_ENTRY
+{
+    std::atomic<uint32_t> seq;
+    std::atomic<uint64_t> key; // 0 is empty
+    std::atomic<uint64_t> value; // expire << 32 | status
+    std::atomic<uint8_t> used;
+};
+
+struct HOST_STATUSES_SET
 {
-    std::unique_lock<std::recursive_mutex> lck( gmutex );
+    HOST_STATUSES_ENTRY entries[HOST_STATUSES_WAYS];
+    unsigned hand; // gmutex
+};
+
+static HOST_STATUSES_SET * host_statuses_db = new HOST_STATUSES_SET[HOST_STATUSES_SETS]();
+static std::recursive_mutex & gmutex = *( new std::recursive_mutex() );
 
-    HOST_STATUSES_DB::iterator lb = host_statuses_db.find( site );
+// only contended acquisitions are timed
+static std::unique_lock<std::recursive_mutex> gmutex_lock()
+{
+    std::unique_lock<std::recursive_mutex> lck( gmutex, std::try_to_lock );
 
-    if( lb != host_statuses_db.end() )
+    if( !lck.owns_lock() )
     {
-        if( lb->second != GOSTSSL_HOST_NO && lb->second != GOSTSSL_HOST_YES )
-            lb->second = status;
+        uint64_t start = stat_now_us();
+        lck.lock();
+        uint64_t wait_us = stat_now_us() - start;
+
+        stat_add( GOSTSSL_STAT_GMUTEX_WAITS );
+        stat_add( GOSTSSL_STAT_GMUTEX_WAIT_US, wait_us );
+        stat_histogram( "Net.GostSSL.MutexWait", wait_us );
     }
-    else
+
+    return lck;
+}
+
+
+#define SIPHASH_ROTL( x, b ) ( ( ( x ) << ( b ) ) | ( ( x ) >> ( 64 - ( b ) ) ) )
+#define SIPHASH_ROUND \
+    v0 += v1; v1 = SIPHASH_ROTL( v1, 13 ); v1 ^= v0; v0 = SIPHASH_ROTL( v0, 32 ); \
+    v2 += v3; v3 = SIPHASH_ROTL( v3, 16 ); v3 ^= v2; \
+    v0 += v3; v3 = SIPHASH_ROTL( v3, 21 ); v3 ^= v0; \
+    v2 += v1; v1 = SIPHASH_ROTL( v1, 17 ); v1 ^= v2; v2 = SIPHASH_ROTL( v2, 32 );
+
+// SipHash-2-4
+static uint64_t siphash24( const uint64_t key[2], const uint8_t * in, size_t len )
+{
+    uint64_t v0 = key[0] ^ 0x736F6D6570736575ULL;
+    uint64_t v1 = key[1] ^ 0x646F72616E646F6DULL;
+    uint64_t v2 = key[0] ^ 0x6C7967656E657261ULL;
+    uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+    uint64_t m;
+    size_t i = 0;
+
+    for( ; i + 8 <= len; i += 8 )
     {
-        host_statuses_db.insert( lb, HOST_STATUSES_DB_PAIR( site, status ) );
+        m = 0;
+        for( int j = 7; j >= 0; j-- )
+            m = ( m << 8 ) | in[i + j];
+
+        v3 ^= m;
+        SIPHASH_ROUND SIPHASH_ROUND
+        v0 ^= m;
     }
+
+    m = (uint64_t)len << 56;
+    for( size_t j = 0; i + j < len; j++ )
+        m |= (uint64_t)in[i + j] << ( 8 * j );
+
+    v3 ^= m;
+    SIPHASH_ROUND SIPHASH_ROUND
+    v0 ^= m;
+
+    v2 ^= 0xFF;
+    SIPHASH_ROUND SIPHASH_ROUND SIPHASH_ROUND SIPHASH_ROUND
+
+    return v0 ^ v1 ^ v2 ^ v3;
 }
 
-GOSTSSL_HOST_STATUS host_status_first( std::string & site )
+// keyed: host names come from pages, colliding ones must not be craftable
+static uint64_t host_statuses_key( const std::string & site )
 {
-    (void)site;
-    return GOSTSSL_HOST_AUTO;
+    uint64_t key = siphash24( host_statuses_secret, (const uint8_t *)site.data(), site.size() );
+    return key ? key : 1;
 }
 
-GOSTSSL_HOST_STATUS host_status_get( std::string & site )
+static uint32_t host_statuses_now()
+{
+    return (uint32_t)std::chrono::duration_cast<std::chrono::seconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+static void host_statuses_read( HOST_STATUSES_ENTRY & e, uint64_t * key, uint64_t * value )
 {
-    if( host_statuses_db.size() )
+    for( ;; )
     {
-        std::unique_lock<std::recursive_mutex> lck( gmutex );
+        uint32_t seq = e.seq.load( std::memory_order_acquire );
 
-        HOST_STATUSES_DB::iterator lb = host_statuses_db.find( site );
+        if( seq & 1 )
+            continue;
 
-        if( lb != host_statuses_db.end() )
-            return lb->second;
-    }
+        *key = e.key.load( std::memory_order_relaxed );
+        *value = e.value.load( std::memory_order_relaxed );
+
+        std::atomic_thread_fence( std::memory_order_acquire );
 
-    return host_status_first( site );
+        if( e.seq.load( std::memory_order_relaxed ) == seq )
+            return;
+    }
 }
 
-typedef enum
+// gmutex must be held
+static void host_statuses_write( HOST_STATUSES_ENTRY & e, uint64_t key, uint64_t value )
 {
-    WDB_SEARCH,
-    WDB_NEW,
-    WDB_FREE,
+    uint32_t seq = e.seq.load( std::memory_order_relaxed );
+
+    e.seq.store( seq + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+    e.key.store( key, std::memory_order_relaxed );
+    e.value.store( value, std::memory_order_relaxed );
+    e.seq.store( seq + 2, std::memory_order_release );
 }
-WORKER_DB_ACTION;
 
-static GostSSL_Worker * workers_api( SSL * s, WORKER_DB_ACTION action, const char * cachestring = NULL )
+static HOST_STATUSES_ENTRY * host_statuses_find( uint64_t key, GOSTSSL_HOST_STATUS * status )
 {
-    GostSSL_Worker * w = NULL;
+    HOST_STATUSES_SET & set = host_statuses_db[key % HOST_STATUSES_SETS];
+    uint32_t now = host_statuses_now();
 
-    if( action == WDB_NEW )
+    for( int i = 0; i < HOST_STATUSES_WAYS; i++ )
     {
-        w = new GostSSL_Worker();
-        w->h = msspi_open( w, (msspi_read_cb)gostssl_read_cb, (msspi_write_cb)gostssl_write_cb );
+        HOST_STATUSES_ENTRY & e = set.entries[i];
+        uint64_t e_key;
+        uint64_t e_value;
 
-        if( !w->h )
-        {
-            delete w;
-            return NULL;
-        }
+        host_statuses_read( e, &e_key, &e_value );
 
-        msspi_set_cert_cb( w->h, (msspi_cert_cb)gostssl_cert_cb );
-        w->s = s;
+        if( e_key != key )
+            continue;
 
-        if( s->hostname.get() )
-            msspi_set_hostname( w->h, s->hostname.get() );
-        if( cachestring )
-            msspi_set_cachestring( w->h, cachestring );
-        if( s->config->alpn_client_proto_list.size() )
-            msspi_set_alpn( w->h, s->config->alpn_client_proto_list.data(), (unsigned)s->config->alpn_client_proto_list.size() );
+        if( (uint32_t)( e_value >> 32 ) <= now )
+            return NULL;
 
-        w->host_string = s->hostname.get() ? s->hostname.get() : "*";
-        w->host_string += ":";
-        w->host_string += cachestring ? cachestring : "*";
+        if( !e.used.load( std::memory_order_relaxed ) )
+            e.used.store( 1, std::memory_order_relaxed );
 
-        w->host_status = host_status_get( w->host_string );
+        *status = (GOSTSSL_HOST_STATUS)( e_value & 0xFF );
+        return &e;
     }
 
-    std::unique_lock<std::recursive_mutex> lck( gmutex );
+    return NULL;
+}
 
-    WORKERS_DB::iterator lb = workers_db.lower_bound( s );
+// gmutex must be held
+static void host_statuses_insert( uint64_t key, GOSTSSL_HOST_STATUS status )
+{
+    HOST_STATUSES_SET & set = host_statuses_db[key % HOST_STATUSES_SETS];
+    uint32_t now = host_statuses_now();
+    uint32_t ttl = ( status == GOSTSSL_HOST_YES || status == GOSTSSL_HOST_NO ) ? HOST_STATUSES_TTL_FINAL : HOST_STATUSES_TTL;
+    uint64_t value = ( (uint64_t)( now + ttl ) << 32 ) | (uint64_t)status;
+    HOST_STATUSES_ENTRY * victim = NULL;
 
-    if( lb != workers_db.end() && !( workers_db.key_comp()( s, lb->first ) ) )
+    for( int i = 0; i < HOST_STATUSES_WAYS; i++ )
     {
-        GostSSL_Worker * w_found = lb->second;
+        HOST_STATUSES_ENTRY & e = set.entries[i];
+        uint64_t e_key = e.key.load( std::memory_order_relaxed );
 
-        if( action == WDB_NEW )
+        if( e_key == key )
         {
-            delete w_found;
-            lb->second = w;
-            return w;
+            victim = &e;
+            break;
         }
-        else if( action == WDB_FREE )
-        {
-            if( w_found->host_status >= GOSTSSL_HOST_PROBING &&
-                w_found->host_status <= GOSTSSL_HOST_PROBING_END )
-            {
-                GOSTSSL_HOST_STATUS status;
 
-                if( w_found->host_status == GOSTSSL_HOST_PROBING_END )
-                    status = GOSTSSL_HOST_AUTO;
-                else
-                    status = (GOSTSSL_HOST_STATUS)( (int)w_found->host_status + 1 );
+        if( !victim && ( !e_key || (uint32_t)( e.value.load( std::memory_order_relaxed ) >> 32 ) <= now ) )
+            victim = &e;
+    }
 
-                host_status_set( w_found->host_string, status );
+    if( !victim )
+    {
+        // CLOCK: skip recently used entries once
+        for( ;; )
+        {
+            HOST_STATUSES_ENTRY & e = set.entries[set.hand];
+            set.hand = ( set.hand + 1 ) % HOST_STATUSES_WAYS;
+
+            if( e.used.load( std::memory_order_relaxed ) )
+            {
+                e.used.store( 0, std::memory_order_relaxed );
+                continue;
             }
 
-            delete w_found;
-            workers_db.erase( lb );
-            return NULL;
+            victim = &e;
+            break;
         }
 
-        return w_found;
+        stat_add( GOSTSSL_STAT_HOST_EVICTIONS );
     }
 
-    if( action == WDB_NEW )
-        workers_db.insert( lb, WORKERS_DB::value_type( s, w ) );
-
-    return w;
+    victim->used.store( 0, std::memory_order_relaxed );
+    host_statuses_write( *victim, key, value );
 }
 
-int gostssl_tls_gost_required( SSL * s )
+static std::atomic<uint32_t> host_statuses_generation( 0 );
+
+// gmutex must be held; statuses guessed before the policy or a hosts file was read are dropped
+static void host_statuses_clear()
 {
-    GostSSL_Worker * w = workers_api( s, WDB_SEARCH );
+    host_statuses_generation.fetch_add( 1, std::memory_order_relaxed );
 
-    if( w && 
-        ( s->s3->hs->new_cipher == tlsgost2001 || s->s3->hs->new_cipher == tlsgost2012 ) )
+    for( int s = 0; s < HOST_STATUSES_SETS; s++ )
     {
-        boring_ERR_clear_error();
-        boring_ERR_put_error( ERR_LIB_SSL, 0, SSL_R_TLS_GOST_REQUIRED, __FILE__, __LINE__ );
-        host_status_set( w->host_string, GOSTSSL_HOST_PROBING );
-        return 1;
-    }
+        for( int i = 0; i < HOST_STATUSES_WAYS; i++ )
+        {
+            HOST_STATUSES_ENTRY & e = host_statuses_db[s].entries[i];
 
-    return 0;
+            if( !e.key.load( std::memory_order_relaxed ) )
+                continue;
+
+            e.used.store( 0, std::memory_order_relaxed );
+            host_statuses_write( e, 0, 0 );
+        }
+    }
 }
 
-static int msspi_to_ssl_version( DWORD dwProtocol )
+/* Files in the data directories Chromium passes per network context (none off the record),
+   read and written in order on a background thread */
+
+#ifdef _WIN32
+typedef std::wstring GOSTSSL_PATH;
+#define GOSTSSL_FOPEN( path, mode ) _wfopen( path.c_str(), L##mode )
+#else
+typedef std::string GOSTSSL_PATH;
+#define GOSTSSL_FOPEN( path, mode ) fopen( path.c_str(), mode )
+#endif // _WIN32
+
+// paths come from Chromium and the environment in UTF-8
+static GOSTSSL_PATH gostssl_path( const char * utf8, const char * name = NULL )
 {
-    switch( dwProtocol )
+    GOSTSSL_PATH path;
+
+#ifdef _WIN32
+    int len = MultiByteToWideChar( CP_UTF8, 0, utf8, -1, NULL, 0 );
+    if( len > 1 )
     {
-        case 0x00000301:
-        case 0x00000040 /*SP_PROT_TLS1_SERVER*/:
-        case 0x00000080 /*SP_PROT_TLS1_CLIENT*/:
-            return TLS1_VERSION;
+        path.resize( (size_t)len );
+        MultiByteToWideChar( CP_UTF8, 0, utf8, -1, &path[0], len );
+        path.resize( (size_t)len - 1 );
+    }
+    if( name )
+        path += L'\\';
+#else
+    path = utf8;
+    if( name )
+        path += '/';
+#endif // _WIN32
 
-        case 0x00000302:
-        case 0x00000100 /*SP_PROT_TLS1_1_SERVER*/:
-        case 0x00000200 /*SP_PROT_TLS1_1_CLIENT*/:
-            return TLS1_1_VERSION;
+    while( name && *name )
+        path += (GOSTSSL_PATH::value_type)*name++;
+
+    return path;
+}
+
+typedef enum
+{
+    FILE_IO_POLICY_LOAD,
+    FILE_IO_HOSTS_LOAD,
+    FILE_IO_HOSTS_STORE,
+}
+FILE_IO_ACTION;
+
+struct HOSTS_FILE;
+
+struct FILE_IO
+{
+    FILE_IO_ACTION action;
+    HOSTS_FILE * file;
+    std::string host;
+    time_t expire;
+};
+
+static std::mutex & file_io_mutex = *( new std::mutex() );
+static std::vector<FILE_IO> & file_io_queue = *( new std::vector<FILE_IO>() );
+static bool file_io_running = false;
+
+static size_t file_io_run( const std::vector<FILE_IO> & batch, size_t i );
+
+// at most one thread drains the queue, it exits when the queue is empty
+static void file_io_thread()
+{
+    std::vector<FILE_IO> batch;
+
+    for( ;; )
+    {
+        {
+            std::unique_lock<std::mutex> lck( file_io_mutex );
+
+            if( file_io_queue.empty() )
+            {
+                file_io_running = false;
+                return;
+            }
+
+            batch.swap( file_io_queue );
+        }
+
+        for( size_t i = 0; i < batch.size(); )
+            i += file_io_run( batch, i );
+
+        batch.clear();
+    }
+}
+
+static void file_io_post( FILE_IO_ACTION action, HOSTS_FILE * file, const std::string & host = std::string(), time_t expire = 0 )
+{
+    FILE_IO io;
+    io.action = action;
+    io.file = file;
+    io.host = host;
+    io.expire = expire;
+
+    std::unique_lock<std::mutex> lck( file_io_mutex );
+
+    file_io_queue.push_back( io );
+
+    if( file_io_running )
+        return;
+
+    file_io_running = true;
+    std::thread( file_io_thread ).detach();
+}
+
+/* Known GOST hosts are kept across restarts */
+
+#define GOSTSSL_HOSTS_FILE "gostssl_hosts"
+#define GOSTSSL_HOSTS_TTL ( 30 * 24 * 60 * 60 )
+
+typedef std::unordered_map< std::string, time_t > HOSTS_FILE_DB;
+
+struct HOSTS_FILE
+{
+    GOSTSSL_PATH path;
+    HOSTS_FILE_DB db; // gmutex, the file as it will be once the queue is written
+};
+
+// by path and by network context (cachestring), gmutex
+static std::map< GOSTSSL_PATH, HOSTS_FILE * > & hosts_files = *( new std::map< GOSTSSL_PATH, HOSTS_FILE * >() );
+static std::unordered_map< std::string, HOSTS_FILE * > & hosts_file_contexts = *( new std::unordered_map< std::string, HOSTS_FILE * >() );
+
+// file I/O thread, true if some hosts became known
+static bool hosts_file_load( HOSTS_FILE * file )
+{
+    FILE * f = GOSTSSL_FOPEN( file->path, "rb" );
+
+    if( !f )
+        return false;
+
+    HOSTS_FILE_DB db;
+    time_t now = time( NULL );
+    size_t records = 0;
+    char line[512];
+    char host[256];
+    long long expire;
+
+    // records are appended, the last record for a host wins
+    while( fgets( line, sizeof( line ), f ) )
+    {
+        if( 2 != sscanf( line, "%lld %255s", &expire, host ) )
+            continue;
+
+        records++;
+
+        if( (time_t)expire > now )
+            db[host] = (time_t)expire;
+        else
+            db.erase( host );
+    }
+
+    fclose( f );
+
+    // compact stale and repeated records
+    if( records != db.size() )
+    {
+        f = GOSTSSL_FOPEN( file->path, "wb" );
+
+        if( f )
+        {
+            for( HOSTS_FILE_DB::iterator it = db.begin(); it != db.end(); it++ )
+                fprintf( f, "%lld %s\n", (long long)it->second, it->first.c_str() );
+
+            fclose( f );
+        }
+    }
+
+    std::unique_lock<std::recursive_mutex> lck = gmutex_lock();
+
+    // hosts learned while the file was being read stay
+    for( HOSTS_FILE_DB::iterator it = db.begin(); it != db.end(); it++ )
+    {
+        time_t & known = file->db[it->first];
+
+        if( known < it->second )
+            known = it->second;
+    }
+
+    return !db.empty();
+}
+
+// file I/O thread; one append for all the records queued at once
+static void hosts_file_store( HOSTS_FILE * file, const FILE_IO * records, size_t count )
+{
+    FILE * f = GOSTSSL_FOPEN( file->path, "ab" );
+
+    if( !f )
+        return;
+
+    for( size_t i = 0; i < count; i++ )
+        fprintf( f, "%lld %s\n", (long long)records[i].expire, records[i].host.c_str() );
+
+    fclose( f );
+}
+
+static std::string host_from_site( const std::string & site )
+{
+    return site.substr( 0, site.rfind( ':' ) );
+}
+
+// gmutex must be held, NULL: off the record or not a Chromium connection
+static HOSTS_FILE * hosts_file_of( const std::string & site )
+{
+    if( hosts_file_contexts.empty() )
+        return NULL;
+
+    std::unordered_map< std::string, HOSTS_FILE * >::iterator it = hosts_file_contexts.find( site.substr( site.rfind( ':' ) + 1 ) );
+    return it == hosts_file_contexts.end() ? NULL : it->second;
+}
+
+// gmutex must be held
+static bool hosts_file_known( const std::string & site )
+{
+    HOSTS_FILE * file = hosts_file_of( site );
+
+    if( !file )
+        return false;
+
+    HOSTS_FILE_DB::iterator it = file->db.find( host_from_site( site ) );
+    return it != file->db.end() && it->second > time( NULL );
+}
+
+// gmutex must be held; remember GOST hosts on disk, forget them once probing gives up
+static void hosts_file_update( std::string & site, GOSTSSL_HOST_STATUS status )
+{
+    HOSTS_FILE * file = hosts_file_of( site );
+
+    if( !file )
+        return;
+
+    std::string host = host_from_site( site );
+
+    if( host.empty() || host == "*" )
+        return;
+
+    HOSTS_FILE_DB::iterator it = file->db.find( host );
+
+    if( status == GOSTSSL_HOST_YES )
+    {
+        time_t now = time( NULL );
+
+        if( it == file->db.end() || it->second < now + GOSTSSL_HOSTS_TTL / 2 )
+        {
+            file->db[host] = now + GOSTSSL_HOSTS_TTL;
+            file_io_post( FILE_IO_HOSTS_STORE, file, host, now + GOSTSSL_HOSTS_TTL );
+        }
+    }
+    else if( status == GOSTSSL_HOST_AUTO || status == GOSTSSL_HOST_NO )
+    {
+        if( it != file->db.end() )
+        {
+            file->db.erase( it );
+            file_io_post( FILE_IO_HOSTS_STORE, file, host, 0 );
+        }
+    }
+}
+
+static void host_status_set( std::string & site, GOSTSSL_HOST_STATUS status )
+{
+    std::unique_lock<std::recursive_mutex> lck = gmutex_lock();
+
+    uint64_t key = host_statuses_key( site );
+    GOSTSSL_HOST_STATUS current;
+
+    // final verdicts stand until they expire
+    if( host_statuses_find( key, &current ) &&
+        ( current == GOSTSSL_HOST_NO || current == GOSTSSL_HOST_YES ) )
+        return;
+
+    host_statuses_insert( key, status );
+    hosts_file_update( site, status );
+}
+
+/* Preloaded domain policy: immutable suffix trie, children sorted by label */
+
+#define GOSTSSL_POLICY_FILE "gostssl_policy"
+#define GOSTSSL_POLICY_NONE 0xFF
+
+struct POLICY_NODE
+{
+    uint32_t label; // offset in policy_labels
+    uint32_t label_len;
+    uint32_t first_child;
+    uint32_t child_count;
+    uint8_t exact;
+    uint8_t wildcard;
+};
+
+// built once by the file I/O thread, read-only after policy_ready
+static std::vector<POLICY_NODE> & policy_nodes = *( new std::vector<POLICY_NODE>() );
+static std::string & policy_labels = *( new std::string() );
+static std::atomic<bool> policy_ready( false );
+static std::once_flag policy_once;
+static GOSTSSL_PATH & policy_dir = *( new GOSTSSL_PATH() ); // gmutex, the first data directory
+
+struct POLICY_BUILD_NODE
+{
+    POLICY_BUILD_NODE() : exact( GOSTSSL_POLICY_NONE ), wildcard( GOSTSSL_POLICY_NONE ) {}
+    std::map< std::string, POLICY_BUILD_NODE > children;
+    uint8_t exact;
+    uint8_t wildcard;
+};
+
+static void policy_flatten( const POLICY_BUILD_NODE & build, uint32_t index )
+{
+    uint32_t first = (uint32_t)policy_nodes.size();
+
+    policy_nodes[index].first_child = first;
+    policy_nodes[index].child_count = (uint32_t)build.children.size();
+    policy_nodes.resize( first + build.children.size() );
+
+    uint32_t i = first;
+    for( std::map< std::string, POLICY_BUILD_NODE >::const_iterator it = build.children.begin(); it != build.children.end(); it++, i++ )
+    {
+        POLICY_NODE & node = policy_nodes[i];
+        node.label = (uint32_t)policy_labels.size();
+        node.label_len = (uint32_t)it->first.size();
+        node.exact = it->second.exact;
+        node.wildcard = it->second.wildcard;
+        policy_labels += it->first;
+    }
+
+    i = first;
+    for( std::map< std::string, POLICY_BUILD_NODE >::const_iterator it = build.children.begin(); it != build.children.end(); it++, i++ )
+        policy_flatten( it->second, i );
+}
+
+// file I/O thread, true once the policy is read; lines: "example.ru yes" (host), "*.example.ru no" (subdomains), status is yes, no or auto
+static bool policy_load()
+{
+    if( policy_ready.load( std::memory_order_relaxed ) )
+        return false;
+
+    GOSTSSL_PATH path;
+    const char * env = getenv( "GOSTSSL_POLICY_FILE" );
+
+    if( env && env[0] )
+        path = gostssl_path( env );
+    else
+    {
+        std::unique_lock<std::recursive_mutex> lck = gmutex_lock();
+
+        if( policy_dir.empty() )
+            return false;
+
+        path = policy_dir;
+    }
+
+    FILE * f = GOSTSSL_FOPEN( path, "rb" );
+
+    if( !f )
+        return false;
+
+    POLICY_BUILD_NODE root;
+    char line[512];
+    char pattern[256];
+    char verdict[16];
+
+    while( fgets( line, sizeof( line ), f ) )
+    {
+        if( 2 != sscanf( line, "%255s %15s", pattern, verdict ) || pattern[0] == '#' )
+            continue;
+
+        uint8_t status;
+        if( 0 == strcmp( verdict, "yes" ) )
+            status = GOSTSSL_HOST_YES;
+        else if( 0 == strcmp( verdict, "no" ) )
+            status = GOSTSSL_HOST_NO;
+        else if( 0 == strcmp( verdict, "auto" ) )
+            status = GOSTSSL_HOST_AUTO;
+        else
+            continue;
+
+        const char * host = pattern;
+        bool wildcard = false;
+
+        if( host[0] == '*' && host[1] == '.' )
+        {
+            wildcard = true;
+            host += 2;
+        }
+
+        POLICY_BUILD_NODE * node = &root;
+        size_t end = strlen( host );
+
+        while( end )
+        {
+            size_t dot = end;
+            while( dot && host[dot - 1] != '.' )
+                dot--;
+
+            std::string label( host + dot, end - dot );
+            for( size_t i = 0; i < label.size(); i++ )
+                label[i] = (char)tolower( (unsigned char)label[i] );
+
+            node = &node->children[label];
+            end = dot ? dot - 1 : 0;
+        }
+
+        if( node == &root )
+            continue;
+
+        if( wildcard )
+            node->wildcard = status;
+        else
+            node->exact = status;
+    }
+
+    fclose( f );
+
+    if( root.children.empty() )
+        return false;
+
+    policy_nodes.resize( 1 );
+    policy_nodes[0].exact = GOSTSSL_POLICY_NONE;
+    policy_nodes[0].wildcard = GOSTSSL_POLICY_NONE;
+    policy_flatten( root, 0 );
+    policy_ready.store( true, std::memory_order_release );
+    return true;
+}
+
+static void policy_post()
+{
+    file_io_post( FILE_IO_POLICY_LOAD, NULL );
+}
+
+// labels in the trie are lowercase
+static int policy_label_cmp( const char * label, size_t len, const char * node_label, size_t node_len )
+{
+    size_t n = len < node_len ? len : node_len;
+
+    for( size_t i = 0; i < n; i++ )
+    {
+        int c = tolower( (unsigned char)label[i] ) - (unsigned char)node_label[i];
+        if( c )
+            return c;
+    }
+
+    return len < node_len ? -1 : ( len > node_len ? 1 : 0 );
+}
+
+// O(label count), no allocations, the longest match wins
+static uint8_t policy_lookup( const char * host, size_t len )
+{
+    // no policy until the file is read
+    std::call_once( policy_once, policy_post );
+
+    if( !policy_ready.load( std::memory_order_acquire ) )
+        return GOSTSSL_POLICY_NONE;
+
+    // fully qualified form ("example.ru.") names the same host
+    while( len && host[len - 1] == '.' )
+        len--;
+
+    const char * labels = policy_labels.data();
+    const POLICY_NODE * node = &policy_nodes[0];
+    uint8_t status = GOSTSSL_POLICY_NONE;
+    size_t end = len;
+
+    while( end )
+    {
+        size_t dot = end;
+        while( dot && host[dot - 1] != '.' )
+            dot--;
+
+        const char * label = host + dot;
+        size_t label_len = end - dot;
+
+        // subdomain of the current node
+        if( node->wildcard != GOSTSSL_POLICY_NONE )
+            status = node->wildcard;
+
+        const POLICY_NODE * child = NULL;
+        uint32_t lo = node->first_child;
+        uint32_t hi = node->first_child + node->child_count;
+
+        while( lo < hi )
+        {
+            uint32_t mid = lo + ( hi - lo ) / 2;
+            const POLICY_NODE & candidate = policy_nodes[mid];
+            int cmp = policy_label_cmp( label, label_len, labels + candidate.label, candidate.label_len );
+
+            if( cmp == 0 )
+            {
+                child = &candidate;
+                break;
+            }
+
+            if( cmp < 0 )
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+
+        if( !child )
+            return status;
+
+        node = child;
+        end = dot ? dot - 1 : 0;
+    }
+
+    return node->exact != GOSTSSL_POLICY_NONE ? node->exact : status;
+}
+
+// runs batch[i] and the stores to the same file queued right after it, returns how many ran
+static size_t file_io_run( const std::vector<FILE_IO> & batch, size_t i )
+{
+    const FILE_IO & io = batch[i];
+    size_t count = 1;
+    bool loaded = false;
+
+    switch( io.action )
+    {
+        case FILE_IO_POLICY_LOAD:
+            loaded = policy_load();
+            break;
+        case FILE_IO_HOSTS_LOAD:
+            loaded = hosts_file_load( io.file );
+            break;
+        case FILE_IO_HOSTS_STORE:
+            while( i + count < batch.size() &&
+                   batch[i + count].action == FILE_IO_HOSTS_STORE && batch[i + count].file == io.file )
+                count++;
+            hosts_file_store( io.file, &io, count );
+            break;
+    }
+
+    // connections made meanwhile cached first guesses without it
+    if( loaded )
+    {
+        std::unique_lock<std::recursive_mutex> lck = gmutex_lock();
+        host_statuses_clear();
+    }
+
+    // counted once connections see it
+    if( io.action == FILE_IO_POLICY_LOAD || io.action == FILE_IO_HOSTS_LOAD )
+        stat_add( GOSTSSL_STAT_FILES_LOADED );
+
+    return count;
+}
+
+GOSTSSL_HOST_STATUS host_status_first( std::string & site )
+{
+    size_t host_len = site.rfind( ':' );
+    uint8_t policy = policy_lookup( site.c_str(), host_len == std::string::npos ? site.size() : host_len );
+
+    if( policy != GOSTSSL_POLICY_NONE )
+        return (GOSTSSL_HOST_STATUS)policy;
+
+    std::unique_lock<std::recursive_mutex> lck = gmutex_lock();
+
+    // known GOST host: go straight to msspi, fall back through probing
+    if( hosts_file_known( site ) )
+        return GOSTSSL_HOST_PROBING;
+
+    return gostssl_gost_first.load( std::memory_order_relaxed ) ? GOSTSSL_HOST_SPECULATIVE : GOSTSSL_HOST_AUTO;
+}
+
+GOSTSSL_HOST_STATUS host_status_get( std::string & site )
+{
+    uint64_t key = host_statuses_key( site );
+    GOSTSSL_HOST_STATUS status;
+
+    if( host_statuses_find( key, &status ) )
+    {
+        stat_add( GOSTSSL_STAT_HOST_HITS );
+        return status;
+    }
+
+    stat_add( GOSTSSL_STAT_HOST_MISSES );
+
+    uint32_t generation = host_statuses_generation.load( std::memory_order_relaxed );
+    status = host_status_first( site );
+
+    std::unique_lock<std::recursive_mutex> lck = gmutex_lock();
+
+    // a concurrent host_status_set wins over the first guess
+    GOSTSSL_HOST_STATUS current;
+    if( host_statuses_find( key, &current ) )
+        return current;
+
+    // a file was read meanwhile: use the guess once, without caching it
+    if( generation != host_statuses_generation.load( std::memory_order_relaxed ) )
+        return status;
+
+    host_statuses_insert( key, status );
+    return status;
+}
+
+/* Probe controller: failed msspi probes of a host back off exponentially */
+
+#define HOST_PROBES_MAX 1024
+#define HOST_PROBES_FREE 2 // failures retried without delay
+#define HOST_PROBES_BACKOFF 60
+#define HOST_PROBES_BACKOFF_MAX ( 60 * 60 )
+#define HOST_PROBES_BACKOFF_MAX_GOST ( 5 * 60 ) // hosts that connected over msspi before
+#define HOST_PROBES_TTL ( 24 * 60 * 60 ) // failure history (negative result) lifetime
+
+struct HOST_PROBE
+{
+    uint32_t failures;
+    uint32_t retry_at;
+    uint32_t expire;
+    bool was_gost; // connected over msspi before: backs off for a shorter time
+};
+
+typedef std::unordered_map< uint64_t, HOST_PROBE > HOST_PROBES_DB;
+
+static HOST_PROBES_DB & host_probes_db = *( new HOST_PROBES_DB() );
+
+// gmutex must be held
+static HOST_PROBE * host_probe_find( uint64_t key, uint32_t now )
+{
+    HOST_PROBES_DB::iterator it = host_probes_db.find( key );
+
+    if( it == host_probes_db.end() )
+        return NULL;
+
+    if( it->second.expire <= now )
+    {
+        host_probes_db.erase( it );
+        return NULL;
+    }
+
+    return &it->second;
+}
+
+// false while the host backs off after failed probes
+static bool host_probe_allowed( std::string & site )
+{
+    std::unique_lock<std::recursive_mutex> lck = gmutex_lock();
+    uint32_t now = host_statuses_now();
+    HOST_PROBE * probe = host_probe_find( host_statuses_key( site ), now );
+
+    return !probe || probe->retry_at <= now;
+}
+
+static void host_probe_failed( std::string & site )
+{
+    std::unique_lock<std::recursive_mutex> lck = gmutex_lock();
+    uint64_t key = host_statuses_key( site );
+    uint32_t now = host_statuses_now();
+    HOST_PROBE * probe = host_probe_find( key, now );
+
+    stat_add( GOSTSSL_STAT_PROBES_FAILED );
+
+    if( !probe )
+    {
+        if( host_probes_db.size() >= HOST_PROBES_MAX )
+        {
+            for( HOST_PROBES_DB::iterator it = host_probes_db.begin(); it != host_probes_db.end(); )
+            {
+                if( it->second.expire <= now )
+                    it = host_probes_db.erase( it );
+                else
+                    it++;
+            }
+
+            if( host_probes_db.size() >= HOST_PROBES_MAX )
+                host_probes_db.erase( host_probes_db.begin() );
+        }
+
+        probe = &host_probes_db[key];
+        probe->failures = 0;
+        probe->was_gost = hosts_file_known( site );
+    }
+
+    probe->failures++;
+    probe->expire = now + HOST_PROBES_TTL;
+
+    if( probe->failures <= HOST_PROBES_FREE )
+    {
+        // transient failure: probe again on the next connection
+        probe->retry_at = now;
+        host_status_set( site, GOSTSSL_HOST_PROBING );
+        return;
+    }
+
+    uint32_t shift = probe->failures - HOST_PROBES_FREE - 1;
+    uint32_t backoff_max = probe->was_gost ? HOST_PROBES_BACKOFF_MAX_GOST : HOST_PROBES_BACKOFF_MAX;
+    uint32_t backoff = shift < 6 ? ( HOST_PROBES_BACKOFF << shift ) : backoff_max;
+
+    if( backoff > backoff_max )
+        backoff = backoff_max;
+
+    probe->retry_at = now + backoff;
+    host_status_set( site, GOSTSSL_HOST_AUTO );
+}
+
+// the history is kept to remember that the host speaks GOST
+static void host_probe_succeeded( std::string & site )
+{
+    std::unique_lock<std::recursive_mutex> lck = gmutex_lock();
+    uint64_t key = host_statuses_key( site );
+    uint32_t now = host_statuses_now();
+    HOST_PROBE * probe = host_probe_find( key, now );
+
+    if( !probe )
+    {
+        if( host_probes_db.size() >= HOST_PROBES_MAX )
+            host_probes_db.erase( host_probes_db.begin() );
+
+        probe = &host_probes_db[key];
+    }
+
+    probe->failures = 0;
+    probe->retry_at = now;
+    probe->expire = now + HOST_PROBES_TTL;
+    probe->was_gost = true;
+}
+
+typedef std::map< std::string, GOSTSSL_CONTEXT * > GOSTSSL_CONTEXTS; // by raw cachestring
+
+static std::mutex & contexts_mutex = *( new std::mutex() );
+static GOSTSSL_CONTEXTS & contexts = *( new GOSTSSL_CONTEXTS() );
+
+static std::string cachestring_hex( void * cachestring, size_t len );
+
+static GOSTSSL_CONTEXT * context_of( void * cachestring, size_t len )
+{
+    // cachestrings are a few bytes (a sequence number), the key needs no heap
+    std::string raw( (const char *)cachestring, len );
+    std::unique_lock<std::mutex> lck( contexts_mutex );
+    GOSTSSL_CONTEXT *& context = contexts[raw];
+
+    if( !context )
+    {
+        context = new GOSTSSL_CONTEXT();
+        context->cachestring = cachestring_hex( cachestring, len );
+    }
+
+    return context;
+}
+
+// host key of a connection: "host:cachestring", built in a per thread buffer
+static std::string & context_site( SSL * s, GOSTSSL_CONTEXT * context )
+{
+    static thread_local std::string site;
+
+    site = s->hostname.get() ? s->hostname.get() : "*";
+    site += ":";
+    site += context ? context->cachestring.c_str() : "*";
+    return site;
+}
+
+// the ex_data slot holds the worker when the connection is GOST-capable (the is_gost bit),
+// otherwise only its context: connections that stay on BoringSSL allocate nothing here
+static GostSSL_Worker * workers_get( SSL * s )
+{
+    if( gostssl_ex_index < 0 || !s->is_gost )
+        return NULL;
+
+    return (GostSSL_Worker *)boring_SSL_get_ex_data( s, gostssl_ex_index );
+}
+
+static GOSTSSL_CONTEXT * workers_context( SSL * s )
+{
+    if( gostssl_ex_index < 0 )
+        return NULL;
+
+    GostSSL_Worker * w = workers_get( s );
+
+    if( w )
+        return w->context;
+
+    return (GOSTSSL_CONTEXT *)boring_SSL_get_ex_data( s, gostssl_ex_index );
+}
+
+// attaches w (msspi path) or only the context (BoringSSL path), frees the previous worker
+static bool workers_set( SSL * s, GostSSL_Worker * w, GOSTSSL_CONTEXT * context )
+{
+    GostSSL_Worker * w_found = workers_get( s );
+
+    if( !boring_SSL_set_ex_data( s, gostssl_ex_index, w ? (void *)w : (void *)context ) )
+        return false;
+
+    boring_set_gost_cb( s, w ? 1 : 0 );
+
+    if( w_found && w_found != w )
+        delete w_found;
+
+    return true;
+}
+
+// opens the msspi handle once the connection is known to go through msspi
+static bool workers_open( GostSSL_Worker * w )
+{
+    if( w->h )
+        return true;
+
+    w->h = msspi_open( w, (msspi_read_cb)gostssl_read_cb, (msspi_write_cb)gostssl_write_cb );
+
+    if( !w->h )
+    {
+        boring_ERR_put_error( ERR_LIB_SSL, 0, ERR_R_INTERNAL_ERROR, __FILE__, __LINE__ );
+        return false;
+    }
+
+    stat_add( GOSTSSL_STAT_MSSPI_OPENED );
+    msspi_set_cert_cb( w->h, (msspi_cert_cb)gostssl_cert_cb );
+
+    SSL * s = w->s;
+
+    if( s->hostname.get() )
+        msspi_set_hostname( w->h, s->hostname.get() );
+    if( w->context )
+        msspi_set_cachestring( w->h, w->context->cachestring.c_str() );
+    if( s->config && s->config->alpn_client_proto_list.size() )
+        msspi_set_alpn( w->h, s->config->alpn_client_proto_list.data(), (unsigned)s->config->alpn_client_proto_list.size() );
+
+    return true;
+}
+
+int gostssl_tls_gost_required( SSL * s )
+{
+    if( s->s3->hs->new_cipher != tlsgost2001 && s->s3->hs->new_cipher != tlsgost2012 )
+        return 0;
+
+    // only connections on the BoringSSL path get here, they carry no worker
+    GOSTSSL_CONTEXT * context = workers_context( s );
+
+    if( context )
+    {
+        std::string & site = context_site( s, context );
+
+        // GOST is disabled for this host by policy: fail as stock BoringSSL would, without a resend
+        if( host_status_get( site ) == GOSTSSL_HOST_NO )
+        {
+            boring_ERR_clear_error();
+            boring_ERR_put_error( ERR_LIB_SSL, 0, SSL_R_UNKNOWN_CIPHER_RETURNED, __FILE__, __LINE__ );
+            return 1;
+        }
+
+        // recent probes failed: stock BoringSSL handles the cipher until the backoff expires
+        if( !host_probe_allowed( site ) )
+        {
+            stat_add( GOSTSSL_STAT_PROBES_SAVED );
+            return 0;
+        }
+
+        boring_ERR_clear_error();
+        boring_ERR_put_error( ERR_LIB_SSL, 0, SSL_R_TLS_GOST_REQUIRED, __FILE__, __LINE__ );
+        host_status_set( site, GOSTSSL_HOST_PROBING );
+        stat_add( GOSTSSL_STAT_GOST_REQUIRED );
+        return 1;
+    }
+
+    return 0;
+}
+
+static int msspi_to_ssl_version( DWORD dwProtocol )
+{
+    switch( dwProtocol )
+    {
+        case 0x00000301:
+        case 0x00000040 /*SP_PROT_TLS1_SERVER*/:
+        case 0x00000080 /*SP_PROT_TLS1_CLIENT*/:
+            return TLS1_VERSION;
+
+        case 0x00000302:
+        case 0x00000100 /*SP_PROT_TLS1_1_SERVER*/:
+        case 0x00000200 /*SP_PROT_TLS1_1_CLIENT*/:
+            return TLS1_1_VERSION;
 
         case 0x00000303:
         case 0x00000400 /*SP_PROT_TLS1_2_SERVER*/:
         case 0x00000800 /*SP_PROT_TLS1_2_CLIENT*/:
             return TLS1_2_VERSION;
 
+        case 0x00000304:
+        case 0x00001000 /*SP_PROT_TLS1_3_SERVER*/:
+        case 0x00002000 /*SP_PROT_TLS1_3_CLIENT*/:
+            return TLS1_3_VERSION;
+
         default:
             return SSL3_VERSION;
     }
@@ -411,7 +1823,7 @@ static int msspi_to_ssl_state_ret( int state, SSL * s, int ret )
 
 int gostssl_read( SSL * s, void * buf, int len, int * is_gost )
 {
-    GostSSL_Worker * w = workers_api( s, WDB_SEARCH );
+    GostSSL_Worker * w = workers_get( s );
 
     // fallback
     if( !w || w->host_status != GOSTSSL_HOST_YES )
@@ -422,13 +1834,26 @@ int gostssl_read( SSL * s, void * buf, int len, int * is_gost )
 
     *is_gost = TRUE;
 
+    if( !workers_open( w ) )
+        return -1;
+
+    // records queued by an earlier call
+    if( !w->wbuf.empty() )
+        gostssl_flush( w );
+
     int ret = msspi_read( w->h, buf, len );
+    if( ret > 0 )
+    {
+        // a record or a part of one per call
+        stat_add( GOSTSSL_STAT_RECORDS_READ );
+        stat_add( GOSTSSL_STAT_BYTES_READ, (uint64_t)ret );
+    }
     return msspi_to_ssl_state_ret( msspi_state( w->h ), s, ret );
 }
 
 int gostssl_peek( SSL * s, void * buf, int len, int * is_gost )
 {
-    GostSSL_Worker * w = workers_api( s, WDB_SEARCH );
+    GostSSL_Worker * w = workers_get( s );
 
     // fallback
     if( !w || w->host_status != GOSTSSL_HOST_YES )
@@ -439,13 +1864,20 @@ int gostssl_peek( SSL * s, void * buf, int len, int * is_gost )
 
     *is_gost = TRUE;
 
+    if( !workers_open( w ) )
+        return -1;
+
+    // records queued by an earlier call
+    if( !w->wbuf.empty() )
+        gostssl_flush( w );
+
     int ret = msspi_peek( w->h, buf, len );
     return msspi_to_ssl_state_ret( msspi_state( w->h ), s, ret );
 }
 
 int gostssl_write( SSL * s, const void * buf, int len, int * is_gost )
 {
-    GostSSL_Worker * w = workers_api( s, WDB_SEARCH );
+    GostSSL_Worker * w = workers_get( s );
 
     // fallback
     if( !w || w->host_status != GOSTSSL_HOST_YES )
@@ -456,31 +1888,133 @@ int gostssl_write( SSL * s, const void * buf, int len, int * is_gost )
 
     *is_gost = TRUE;
 
+    if( !workers_open( w ) )
+        return -1;
+
+    // records of the previous call are still pending (the caller retries with the same buffer)
+    if( !w->wbuf.empty() )
+    {
+        if( !gostssl_flush( w ) )
+        {
+            s->s3->rwstate = SSL_WRITING;
+            return -1;
+        }
+
+        if( w->wpend_ret )
+        {
+            int ret = w->wpend_ret;
+            w->wpend_ret = 0;
+            s->s3->rwstate = SSL_NOTHING;
+            return ret;
+        }
+    }
+
+    w->wcoalesce = true;
     int ret = msspi_write( w->h, buf, len );
+    w->wcoalesce = false;
+
+    if( ret > 0 )
+        stat_add( GOSTSSL_STAT_BYTES_WRITTEN, (uint64_t)ret );
+
+    if( !gostssl_flush( w ) && ret > 0 )
+    {
+        w->wpend_ret = ret;
+        s->s3->rwstate = SSL_WRITING;
+        return -1;
+    }
+
     return msspi_to_ssl_state_ret( msspi_state( w->h ), s, ret );
 }
 
 #define B2C(x) ( x < 0xA ? x + '0' : x + 'A' - 10 )
 
-void gostssl_cachestring( SSL * s, void * cachestring, size_t len )
+static std::string cachestring_hex( void * cachestring, size_t len )
 {
     BYTE * bb = (BYTE *)cachestring;
-    std::vector<BYTE> cc;
-    cc.resize( len * 2 + 1 );
-    for( int i = 0; i < 8; i++ )
+    std::string cc;
+    cc.resize( len * 2 );
+    for( size_t i = 0; i < len; i++ )
     {
         BYTE xF = ( bb[i] ) >> 4;
         BYTE Fx = ( bb[i] ) & 0xF;
-        cc[i * 2 + 0] = B2C( xF );
-        cc[i * 2 + 1] = B2C( Fx );
+        cc[i * 2 + 0] = (char)B2C( xF );
+        cc[i * 2 + 1] = (char)B2C( Fx );
+    }
+    return cc;
+}
+
+void gostssl_cachestring( SSL * s, void * cachestring, size_t len )
+{
+    if( gostssl_ex_index < 0 )
+        return;
+
+    stat_report();
+
+    GOSTSSL_CONTEXT * context = context_of( cachestring, len );
+    std::string & site = context_site( s, context );
+    GOSTSSL_HOST_STATUS status = host_status_get( site );
+
+    // connections that can never be GOST take the stock BoringSSL path, without a worker
+    if( status == GOSTSSL_HOST_AUTO || status == GOSTSSL_HOST_NO )
+    {
+        workers_set( s, NULL, context );
+        return;
+    }
+
+    // only the host key here, the msspi handle is opened by workers_open
+    GostSSL_Worker * w = new GostSSL_Worker();
+    w->s = s;
+    w->context = context;
+    w->host_string = site;
+    w->host_status = status;
+
+    if( !workers_set( s, w, context ) )
+        delete w;
+}
+
+// the network context with this cachestring keeps its files in dir, never called off the record
+void gostssl_datadirhook( void * cachestring, size_t len, const char * dir )
+{
+    if( !dir || !dir[0] )
+        return;
+
+    GOSTSSL_PATH path = gostssl_path( dir, GOSTSSL_HOSTS_FILE );
+    HOSTS_FILE * file;
+    bool first;
+    bool load;
+
+    {
+        std::unique_lock<std::recursive_mutex> lck = gmutex_lock();
+
+        first = hosts_files.empty();
+
+        if( first )
+            policy_dir = gostssl_path( dir, GOSTSSL_POLICY_FILE );
+
+        // profiles have a context per storage partition, some share a directory
+        HOSTS_FILE *& slot = hosts_files[path];
+        load = !slot;
+
+        if( load )
+        {
+            slot = new HOSTS_FILE();
+            slot->path = path;
+        }
+
+        file = slot;
+        hosts_file_contexts[cachestring_hex( cachestring, len )] = file;
     }
-    cc[len * 2] = 0;
-    workers_api( s, WDB_NEW, (char *)&cc[0] );
+
+    if( first )
+        file_io_post( FILE_IO_POLICY_LOAD, NULL );
+
+    if( load )
+        file_io_post( FILE_IO_HOSTS_LOAD, file );
 }
 
 int gostssl_connect( SSL * s, int * is_gost )
 {
-    GostSSL_Worker * w = workers_api( s, WDB_SEARCH );
+    GostSSL_Worker * w = workers_get( s );
 
     // fallback
     if( !w || w->host_status == GOSTSSL_HOST_AUTO || w->host_status == GOSTSSL_HOST_NO )
@@ -489,9 +2023,39 @@ int gostssl_connect( SSL * s, int * is_gost )
         return 1;
     }
 
+    // no CSP session: stock BoringSSL, as if the worker was never created
+    // (w is freed, its slot exists already and takes the context back)
+    if( !workers_open( w ) )
+    {
+        boring_ERR_clear_error();
+        workers_set( s, NULL, w->context );
+        *is_gost = FALSE;
+        return 1;
+    }
+
     *is_gost = TRUE;
 
+    // records queued by an earlier call
+    if( !w->wbuf.empty() )
+        gostssl_flush( w );
+
+    // resumed by the certificate verifier, only the verification result is left to apply
+    if( w->verify_retry )
+    {
+        s->s3->rwstate = SSL_NOTHING;
+
+        int ssl_ret = boring_set_connected_cb( s, NULL, 0, 0, 0, NULL, NULL, 0 );
+        if( ssl_ret < 0 )
+            return -1;
+
+        w->verify_retry = false;
+        verify_pending_set( w, false );
+        return ssl_ret ? 1 : -1;
+    }
+
+    uint64_t start = stat_now_us();
     int ret = msspi_connect( w->h );
+    w->connect_us += stat_now_us() - start;
 
     if( ret == 1 )
     {
@@ -538,87 +2102,288 @@ int gostssl_connect( SSL * s, int * is_gost )
         }
 
         // force GOST for broken clients and IIS (regsvr32 -u cpcng.dll)
-        if( cipher_id != TLS_GOST_CIPHER_2001 && cipher_id != TLS_GOST_CIPHER_2012 )
+        // the key algorithm is read in place from the buffer msspi returned
+        if( !is_gost_cipher( cipher_id ) )
         {
-            PCCERT_CONTEXT certcheck = CertCreateCertificateContext( X509_ASN_ENCODING, (BYTE *)servercerts_bufs[0], (DWORD)servercerts_lens[0] );
+            DER_SPAN oid;
 
-            if( !certcheck )
+            if( !servercerts_count || !der_cert_spki_oid( (const uint8_t *)servercerts_bufs[0], (size_t)servercerts_lens[0], &oid ) )
                 return 0;
 
-            if( 0 == strcmp( certcheck->pCertInfo->SubjectPublicKeyInfo.Algorithm.pszObjId, szOID_CP_GOST_R3410EL ) )
+            if( der_oid_in( oid, gost2001_key_oids, sizeof( gost2001_key_oids ) / sizeof( gost2001_key_oids[0] ) ) )
                 cipher_id = TLS_GOST_CIPHER_2001;
-            else if( 0 == strcmp( certcheck->pCertInfo->SubjectPublicKeyInfo.Algorithm.pszObjId, szOID_CP_GOST_R3410_12_256 ) ||
-                0 == strcmp( certcheck->pCertInfo->SubjectPublicKeyInfo.Algorithm.pszObjId, szOID_CP_GOST_R3410_12_512 ) )
+            else if( der_oid_in( oid, gost2012_key_oids, sizeof( gost2012_key_oids ) / sizeof( gost2012_key_oids[0] ) ) )
                 cipher_id = TLS_GOST_CIPHER_2012;
+        }
 
-            CertFreeCertificateContext( certcheck );
+        // speculative msspi connection to a non-GOST host: finish it, but keep the host on BoringSSL
+        if( w->host_status == GOSTSSL_HOST_SPECULATIVE &&
+            !is_gost_cipher( cipher_id ) )
+            host_status_set( w->host_string, GOSTSSL_HOST_AUTO );
+        else
+        {
+            host_status_set( w->host_string, GOSTSSL_HOST_YES );
+            host_probe_succeeded( w->host_string );
         }
 
         w->host_status = GOSTSSL_HOST_YES;
-        host_status_set( w->host_string, GOSTSSL_HOST_YES );
 
-        char ssl_ret = boring_set_connected_cb( w->s, alpn, alpn_len, version, cipher_id, &servercerts_bufs[0], &servercerts_lens[0], servercerts_count );
+        stat_add( GOSTSSL_STAT_HANDSHAKES );
+        stat_add( GOSTSSL_STAT_HANDSHAKE_US, w->connect_us );
+        stat_histogram( "Net.GostSSL.HandshakeTime", w->connect_us );
+
+        // only this chain for this host goes to gostssl_verifychainhook
+        if( servercerts_count )
+        {
+            w->verify_key.assign( w->s->hostname.get() ? w->s->hostname.get() : "" );
+            w->verify_key.push_back( '\0' );
+            w->verify_key.append( servercerts_bufs[0], (size_t)servercerts_lens[0] );
+            verify_pending_set( w, true );
+        }
+
+        int ssl_ret = boring_set_connected_cb( w->s, alpn, alpn_len, version, cipher_id, &servercerts_bufs[0], &servercerts_lens[0], servercerts_count );
+
+        // the certificate verifier went asynchronous, it calls the handshake again
+        if( ssl_ret < 0 )
+        {
+            w->verify_retry = true;
+            return -1;
+        }
+
+        verify_pending_set( w, false );
+
         if( !ssl_ret )
             return -1;
 
         return 1;
     }
 
-    return msspi_to_ssl_state_ret( msspi_state( w->h ), s, ret );
+    int state = msspi_state( w->h );
+
+    // only a transport or handshake error is a failed probe: once the server asked for a client
+    // certificate, a rejected or cancelled one is not; a cancel never reaches MSSPI_ERROR
+    if( w->host_status == GOSTSSL_HOST_PROBING && ( state & MSSPI_ERROR ) && !w->client_auth )
+        host_probe_failed( w->host_string );
+
+    // speculative msspi handshake failed: resend over BoringSSL (mirror gostssl_tls_gost_required)
+    if( w->host_status == GOSTSSL_HOST_SPECULATIVE && ( state & MSSPI_ERROR ) )
+    {
+        host_status_set( w->host_string, GOSTSSL_HOST_AUTO );
+        boring_ERR_clear_error();
+        boring_ERR_put_error( ERR_LIB_SSL, 0, SSL_R_TLS_GOST_REQUIRED, __FILE__, __LINE__ );
+        s->s3->rwstate = SSL_NOTHING;
+        return -1;
+    }
+
+    return msspi_to_ssl_state_ret( state, s, ret );
 }
 
+// called by SSL_free for GOST-capable connections only
 void gostssl_free( SSL * s )
 {
-    workers_api( s, WDB_FREE );
+    GostSSL_Worker * w = workers_get( s );
+
+    if( !w )
+        return;
+
+    boring_SSL_set_ex_data( s, gostssl_ex_index, NULL );
+    boring_set_gost_cb( s, 0 );
+    delete w;
 }
 
-void gostssl_verifyhook( void * s, unsigned * gost_status )
+void gostssl_certhook( void * s, void * cert, int size )
 {
-    *gost_status = 0;
+    if( !cert )
+        return;
 
-    GostSSL_Worker * w = workers_api( (SSL *)s, WDB_SEARCH );
+    GostSSL_Worker * w = workers_get( (SSL *)s );
 
-    if( !w || w->host_status != GOSTSSL_HOST_YES )
+    if( !w || w->cert )
         return;
 
-    unsigned verify_status = msspi_verify( w->h );
+    if( size == 0 )
+        w->cert = CertDuplicateCertificateContext( (PCCERT_CONTEXT)cert );
+    else
+        w->cert = CertCreateCertificateContext( X509_ASN_ENCODING, (BYTE *)cert, size );
+}
+
+// CAPI chain building (revocation included) and the SSL policy for the host, 1 or CERT_E_*
+static unsigned verify_chain( const char * host, const char ** bufs, const int * lens, size_t count )
+{
+    HCERTSTORE hStore = CertOpenStore( CERT_STORE_PROV_MEMORY, 0, 0, CERT_STORE_CREATE_NEW_FLAG, NULL );
+
+    // no CAPI: Chromium verifies the chain itself
+    if( !hStore )
+        return 0;
+
+    unsigned status = (unsigned)CERT_E_CRITICAL;
+    PCCERT_CONTEXT leaf = NULL;
+    bool added = true;
 
-    switch( verify_status )
+    for( size_t i = 0; i < count; i++ )
     {
-        case MSSPI_VERIFY_OK:
-            *gost_status = 1;
-            break;
-        case MSSPI_VERIFY_ERROR:
-            *gost_status = (unsigned)CERT_E_CRITICAL;
+        if( !CertAddEncodedCertificateToStore( hStore, X509_ASN_ENCODING | PKCS_7_ASN_ENCODING,
+                (const BYTE *)bufs[i], (DWORD)lens[i], CERT_STORE_ADD_ALWAYS, i == 0 ? &leaf : NULL ) )
+        {
+            added = false;
             break;
-        default:
-            *gost_status = verify_status;
+        }
     }
-}
 
-static std::vector<char *> & g_certs = *( new std::vector<char *>() );
-static std::vector<int> & g_certlens = *( new std::vector<int>() );
-static std::vector<std::string> & g_certbufs = *( new std::vector<std::string>() );
+    if( added && leaf )
+    {
+        LPSTR server_auth = (LPSTR)szOID_PKIX_KP_SERVER_AUTH;
+        CERT_CHAIN_PARA chain_para;
+        memset( &chain_para, 0, sizeof( chain_para ) );
+        chain_para.cbSize = sizeof( chain_para );
+        chain_para.RequestedUsage.dwType = USAGE_MATCH_TYPE_AND;
+        chain_para.RequestedUsage.Usage.cUsageIdentifier = 1;
+        chain_para.RequestedUsage.Usage.rgpszUsageIdentifier = &server_auth;
+
+        PCCERT_CHAIN_CONTEXT chain = NULL;
+
+        if( CertGetCertificateChain( NULL, leaf, NULL, hStore, &chain_para, CERT_CHAIN_REVOCATION_CHECK_CHAIN_EXCLUDE_ROOT, NULL, &chain ) )
+        {
+            // host names are ASCII (IDN arrive in punycode)
+            std::wstring server_name( host, host + strlen( host ) );
 
-static std::vector<wchar_t *> & g_certnames = *( new std::vector<wchar_t *>() );
-static std::vector<std::wstring> & g_certnamebufs = *( new std::vector<std::wstring>() );
+            SSL_EXTRA_CERT_CHAIN_POLICY_PARA ssl_para;
+            memset( &ssl_para, 0, sizeof( ssl_para ) );
+            ssl_para.cbSize = sizeof( ssl_para );
+            ssl_para.dwAuthType = AUTHTYPE_SERVER;
+            ssl_para.pwszServerName = &server_name[0];
 
-void gostssl_clientcertshook( char *** certs, int ** lens, wchar_t *** names, int * count, int * is_gost )
+            CERT_CHAIN_POLICY_PARA policy_para;
+            memset( &policy_para, 0, sizeof( policy_para ) );
+            policy_para.cbSize = sizeof( policy_para );
+            policy_para.pvExtraPolicyPara = &ssl_para;
+
+            CERT_CHAIN_POLICY_STATUS policy_status;
+            memset( &policy_status, 0, sizeof( policy_status ) );
+            policy_status.cbSize = sizeof( policy_status );
+
+            if( CertVerifyCertificateChainPolicy( CERT_CHAIN_POLICY_SSL, chain, &policy_para, &policy_status ) )
+                status = policy_status.dwError ? (unsigned)policy_status.dwError : 1;
+
+            CertFreeCertificateChain( chain );
+        }
+    }
+
+    if( leaf )
+        CertFreeCertificateContext( leaf );
+
+    CertCloseStore( hStore, 0 );
+    return status;
+}
+
+// called by CertVerifyProc on a worker thread, blocks for the whole verification;
+// chains msspi did not negotiate are left to Chromium (*gost_status = 0)
+void gostssl_verifychainhook( const char * host, const char ** certs, const int * lens, size_t count, unsigned * gost_status )
 {
-    *is_gost = 1;
-    *count = 0;
+    *gost_status = 0;
+
+    if( !host || !count )
+        return;
 
-    HCERTSTORE hStore = CertOpenStore( CERT_STORE_PROV_SYSTEM_A, 0, 0, CERT_STORE_OPEN_EXISTING_FLAG | CERT_STORE_READONLY_FLAG, "MY" );
+    std::string key( host );
+    key.push_back( '\0' );
+    key.append( certs[0], (size_t)lens[0] );
 
-    if( !hStore )
+    if( !verify_pending_find( key ) )
         return;
 
-    int i = 0;
-    g_certs.clear();
-    g_certlens.clear();
-    g_certbufs.clear();
-    g_certnames.clear();
-    g_certnamebufs.clear();
+    uint64_t start = stat_now_us();
+    unsigned verify_status = verify_chain( host, certs, lens, count );
+    uint64_t verify_us = stat_now_us() - start;
+
+    if( !verify_status )
+        return;
+
+    stat_add( GOSTSSL_STAT_VERIFY_US, verify_us );
+    stat_histogram( "Net.GostSSL.VerifyTime", verify_us );
+
+    *gost_status = verify_status;
+}
+
+/* Client certificates: a snapshot of the "MY" store, rebuilt only on change or expiry */
+
+#define CLIENTCERTS_RECHECK 30 // seconds between background comparisons with the store (no notifications)
+
+struct CLIENTCERTS_SNAPSHOT
+{
+    std::vector<std::string> certs;
+    std::vector<std::wstring> names;
+    uint64_t fingerprint;
+    uint64_t expire; // FILETIME of the nearest NotBefore/NotAfter boundary
+};
+
+typedef std::shared_ptr<const CLIENTCERTS_SNAPSHOT> CLIENTCERTS_SNAPSHOT_PTR;
+
+static std::mutex & clientcerts_mutex = *( new std::mutex() );
+static CLIENTCERTS_SNAPSHOT_PTR & clientcerts_snapshot = *( new CLIENTCERTS_SNAPSHOT_PTR() );
+
+#ifdef _WIN32
+static HCERTSTORE clientcerts_store = NULL;
+static HANDLE clientcerts_event = NULL;
+#else
+static uint32_t clientcerts_checked = 0; // guarded by clientcerts_mutex
+static bool clientcerts_rechecking = false;
+#endif // _WIN32
+
+// results are returned as pointers into the calling thread's reference to a snapshot
+struct CLIENTCERTS_VIEW
+{
+    CLIENTCERTS_SNAPSHOT_PTR snapshot;
+    std::vector<char *> certs;
+    std::vector<int> lens;
+    std::vector<wchar_t *> names;
+};
+
+static thread_local CLIENTCERTS_VIEW clientcerts_view;
+
+static uint64_t clientcerts_filetime( const FILETIME & ft )
+{
+    return ( (uint64_t)ft.dwHighDateTime << 32 ) | ft.dwLowDateTime;
+}
+
+static uint64_t clientcerts_now()
+{
+    // FILETIME counts 100ns intervals since 1601
+    return ( (uint64_t)time( NULL ) + 11644473600ULL ) * 10000000ULL;
+}
+
+static HCERTSTORE clientcerts_open()
+{
+    return CertOpenStore( CERT_STORE_PROV_SYSTEM_A, 0, 0, CERT_STORE_OPEN_EXISTING_FLAG | CERT_STORE_READONLY_FLAG, "MY" );
+}
+
+// cheap enumeration without per certificate decoding
+static uint64_t clientcerts_fingerprint( HCERTSTORE hStore )
+{
+    uint64_t fingerprint = 14695981039346656037ULL;
+
+    for( PCCERT_CONTEXT pcert = CertFindCertificateInStore( hStore, PKCS_7_ASN_ENCODING | X509_ASN_ENCODING, 0, CERT_FIND_ANY, 0, 0 );
+         pcert;
+         pcert = CertFindCertificateInStore( hStore, PKCS_7_ASN_ENCODING | X509_ASN_ENCODING, 0, CERT_FIND_ANY, 0, pcert ) )
+    {
+        DWORD dw = 0;
+        uint8_t has_key = CertGetCertificateContextProperty( pcert, CERT_KEY_PROV_INFO_PROP_ID, NULL, &dw ) ? 1 : 0;
+
+        for( DWORD i = 0; i < pcert->cbCertEncoded; i++ )
+            fingerprint = ( fingerprint ^ pcert->pbCertEncoded[i] ) * 1099511628211ULL;
+        fingerprint = ( fingerprint ^ has_key ) * 1099511628211ULL;
+    }
+
+    return fingerprint;
+}
+
+static CLIENTCERTS_SNAPSHOT * clientcerts_build( HCERTSTORE hStore )
+{
+    CLIENTCERTS_SNAPSHOT * snapshot = new CLIENTCERTS_SNAPSHOT();
+    uint64_t now = clientcerts_now();
+
+    snapshot->fingerprint = clientcerts_fingerprint( hStore );
+    snapshot->expire = (uint64_t)-1;
 
     for( PCCERT_CONTEXT pcert = CertFindCertificateInStore( hStore, PKCS_7_ASN_ENCODING | X509_ASN_ENCODING, 0, CERT_FIND_ANY, 0, 0 );
          pcert;
@@ -626,49 +2391,199 @@ void gostssl_clientcertshook( char *** certs, int ** lens, wchar_t *** names, in
     {
         BYTE bUsage;
         DWORD dw = 0;
+        LONG validity;
+
         // basic cert validation
-        if( ( CertGetIntendedKeyUsage( X509_ASN_ENCODING, pcert->pCertInfo, &bUsage, 1 ) ) &&
-            ( bUsage & CERT_DIGITAL_SIGNATURE_KEY_USAGE ) &&
-            ( CertVerifyTimeValidity( NULL, pcert->pCertInfo ) == 0 ) &&
-            ( CertGetCertificateContextProperty( pcert, CERT_KEY_PROV_INFO_PROP_ID, NULL, &dw ) ) )
+        if( !( CertGetIntendedKeyUsage( X509_ASN_ENCODING, pcert->pCertInfo, &bUsage, 1 ) ) ||
+            !( bUsage & CERT_DIGITAL_SIGNATURE_KEY_USAGE ) ||
+            !( CertGetCertificateContextProperty( pcert, CERT_KEY_PROV_INFO_PROP_ID, NULL, &dw ) ) )
+            continue;
+
+        validity = CertVerifyTimeValidity( NULL, pcert->pCertInfo );
+
+        // not yet valid, the snapshot expires when it becomes valid
+        if( validity < 0 )
         {
-            g_certbufs.push_back( std::string( (char *)pcert->pbCertEncoded, pcert->cbCertEncoded ) );
-            g_certlens.push_back( (int)g_certbufs[i].size() );
-            g_certs.push_back( &g_certbufs[i][0] );
+            uint64_t not_before = clientcerts_filetime( pcert->pCertInfo->NotBefore );
+            if( not_before > now && not_before < snapshot->expire )
+                snapshot->expire = not_before;
+            continue;
+        }
 
-            if( names )
-            {
-                std::wstring name;
-                wchar_t wName[1024];
-                DWORD dwName;
+        if( validity > 0 )
+            continue;
 
-                dwName = (DWORD)( sizeof( wName ) / sizeof( wName[0] ) );
-                dwName = CertGetNameStringW( pcert, CERT_NAME_SIMPLE_DISPLAY_TYPE, 0, NULL, wName, dwName );
+        uint64_t not_after = clientcerts_filetime( pcert->pCertInfo->NotAfter );
+        if( not_after < snapshot->expire )
+            snapshot->expire = not_after;
 
-                name = dwName > 1 ? wName : L"...";
+        snapshot->certs.push_back( std::string( (char *)pcert->pbCertEncoded, pcert->cbCertEncoded ) );
 
-                dwName = (DWORD)( sizeof( wName ) / sizeof( wName[0] ) );
-                dwName = CertGetNameStringW( pcert, CERT_NAME_SIMPLE_DISPLAY_TYPE, CERT_NAME_ISSUER_FLAG, NULL, wName, dwName );
+        std::wstring name;
+        wchar_t wName[1024];
+        DWORD dwName;
 
-                name = name + L" (" + ( dwName > 1 ? wName : L"..." ) + L")";
+        dwName = (DWORD)( sizeof( wName ) / sizeof( wName[0] ) );
+        dwName = CertGetNameStringW( pcert, CERT_NAME_SIMPLE_DISPLAY_TYPE, 0, NULL, wName, dwName );
 
-                g_certnamebufs.push_back( name );
-                g_certnames.push_back( &g_certnamebufs[i][0] );
-            }
-            i++;
+        name = dwName > 1 ? wName : L"...";
+
+        dwName = (DWORD)( sizeof( wName ) / sizeof( wName[0] ) );
+        dwName = CertGetNameStringW( pcert, CERT_NAME_SIMPLE_DISPLAY_TYPE, CERT_NAME_ISSUER_FLAG, NULL, wName, dwName );
+
+        name = name + L" (" + ( dwName > 1 ? wName : L"..." ) + L")";
+
+        snapshot->names.push_back( name );
+    }
+
+    return snapshot;
+}
+
+#ifndef _WIN32
+// runs on its own thread, a reset by gostssl_certdbchangedhook or a newer snapshot wins
+static void clientcerts_recheck( CLIENTCERTS_SNAPSHOT_PTR snapshot )
+{
+    CLIENTCERTS_SNAPSHOT_PTR fresh;
+    HCERTSTORE hStore = clientcerts_open();
+
+    if( hStore )
+    {
+        if( snapshot->fingerprint != clientcerts_fingerprint( hStore ) )
+            fresh.reset( clientcerts_build( hStore ) );
+
+        CertCloseStore( hStore, 0 );
+    }
+
+    std::unique_lock<std::mutex> lck( clientcerts_mutex );
+
+    if( fresh && clientcerts_snapshot == snapshot )
+        clientcerts_snapshot = fresh;
+
+    clientcerts_rechecking = false;
+}
+#endif // !_WIN32
+
+static CLIENTCERTS_SNAPSHOT_PTR clientcerts_get()
+{
+    std::unique_lock<std::mutex> lck( clientcerts_mutex );
+    CLIENTCERTS_SNAPSHOT_PTR snapshot = clientcerts_snapshot;
+
+    if( snapshot && snapshot->expire <= clientcerts_now() )
+        snapshot.reset();
+
+#ifdef _WIN32
+    if( !clientcerts_store )
+    {
+        clientcerts_store = clientcerts_open();
+        if( !clientcerts_store )
+            return CLIENTCERTS_SNAPSHOT_PTR();
+
+        clientcerts_event = CreateEvent( NULL, FALSE, FALSE, NULL );
+        if( clientcerts_event && !CertControlStore( clientcerts_store, 0, CERT_STORE_CTRL_NOTIFY_CHANGE, &clientcerts_event ) )
+        {
+            CloseHandle( clientcerts_event );
+            clientcerts_event = NULL;
+        }
+    }
+
+    if( clientcerts_event )
+    {
+        // store change notification
+        if( WaitForSingleObject( clientcerts_event, 0 ) == WAIT_OBJECT_0 )
+        {
+            CertControlStore( clientcerts_store, 0, CERT_STORE_CTRL_RESYNC, &clientcerts_event );
+            snapshot.reset();
         }
     }
+    else if( snapshot && snapshot->fingerprint != clientcerts_fingerprint( clientcerts_store ) )
+        snapshot.reset();
 
-    if( i )
+    if( !snapshot )
+    {
+        snapshot.reset( clientcerts_build( clientcerts_store ) );
+        clientcerts_snapshot = snapshot;
+    }
+#else
+    // no change notifications here: serve the snapshot, compare it with the store in the background
+    if( snapshot )
     {
-        *certs = &g_certs[0];
-        *lens = &g_certlens[0];
-        if( names )
-            *names = &g_certnames[0];
-        *count = i;
+        uint32_t now = host_statuses_now();
+
+        if( !clientcerts_rechecking && clientcerts_checked + CLIENTCERTS_RECHECK <= now )
+        {
+            clientcerts_rechecking = true;
+            clientcerts_checked = now;
+            std::thread( clientcerts_recheck, snapshot ).detach();
+        }
+
+        return snapshot;
     }
 
+    // first use or invalidated: build without holding the lock
+    lck.unlock();
+
+    HCERTSTORE hStore = clientcerts_open();
+
+    if( !hStore )
+        return CLIENTCERTS_SNAPSHOT_PTR();
+
+    snapshot.reset( clientcerts_build( hStore ) );
     CertCloseStore( hStore, 0 );
+
+    lck.lock();
+    clientcerts_snapshot = snapshot;
+    clientcerts_checked = host_statuses_now();
+#endif // _WIN32
+
+    return snapshot;
+}
+
+// prebuild the snapshot off the network thread
+static void clientcerts_prefetch()
+{
+    std::thread( []() { clientcerts_get(); } ).detach();
+}
+
+void gostssl_clientcertshook( char *** certs, int ** lens, wchar_t *** names, int * count, int * is_gost )
+{
+    *is_gost = 1;
+    *count = 0;
+
+    CLIENTCERTS_VIEW & view = clientcerts_view;
+
+    uint64_t start = stat_now_us();
+    view.snapshot = clientcerts_get();
+    uint64_t lookup_us = stat_now_us() - start;
+
+    stat_add( GOSTSSL_STAT_CLIENTCERTS_LOOKUPS );
+    stat_add( GOSTSSL_STAT_CLIENTCERTS_US, lookup_us );
+    stat_histogram( "Net.GostSSL.ClientCertsTime", lookup_us );
+    view.certs.clear();
+    view.lens.clear();
+    view.names.clear();
+
+    if( !view.snapshot || view.snapshot->certs.empty() )
+        return;
+
+    for( size_t i = 0; i < view.snapshot->certs.size(); i++ )
+    {
+        view.certs.push_back( (char *)view.snapshot->certs[i].data() );
+        view.lens.push_back( (int)view.snapshot->certs[i].size() );
+        view.names.push_back( (wchar_t *)view.snapshot->names[i].c_str() );
+    }
+
+    *certs = &view.certs[0];
+    *lens = &view.lens[0];
+    if( names )
+        *names = &view.names[0];
+    *count = (int)view.certs.size();
+}
+
+// trust settings or certificates changed
+void gostssl_certdbchangedhook()
+{
+    std::unique_lock<std::mutex> lck( clientcerts_mutex );
+    clientcerts_snapshot.reset();
 }
 
 /* CAPI Proxy (capix) section for non Windows systems */
@@ -690,38 +2605,46 @@ extern "C" {
 }
 #endif
 
-#ifdef _WIN32
-#define CAPI10_LIB "capi10_win.dll"
-#define CAPI20_LIB "capi20_win.dll"
+#if defined( _WIN32 )
+#define CAPI10_LIB_DEFAULT "capi10_win.dll"
+#define CAPI20_LIB_DEFAULT "capi20_win.dll"
 #elif defined( __APPLE__ )
-#define CAPI10_LIB "/opt/cprocsp/lib/libcapi10.dylib"
-#define CAPI20_LIB "/opt/cprocsp/lib/libcapi20.dylib"
+#define CAPI10_LIB_DEFAULT "/opt/cprocsp/lib/libcapi10.dylib"
+#define CAPI20_LIB_DEFAULT "/opt/cprocsp/lib/libcapi20.dylib"
 #include <TargetConditionals.h>
 #else // other LINUX
 #if defined( __mips__ ) // archs
     #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-        #define CAPI10_LIB "/opt/cprocsp/lib/mipsel/libcapi10.so"
-        #define CAPI20_LIB "/opt/cprocsp/lib/mipsel/libcapi20.so"
+        #define CAPI10_LIB_DEFAULT "/opt/cprocsp/lib/mipsel/libcapi10.so"
+        #define CAPI20_LIB_DEFAULT "/opt/cprocsp/lib/mipsel/libcapi20.so"
     #else // byte order
-        #define CAPI10_LIB "/opt/cprocsp/lib/mips/libcapi10.so"
-        #define CAPI20_LIB "/opt/cprocsp/lib/mips/libcapi20.so"
+        #define CAPI10_LIB_DEFAULT "/opt/cprocsp/lib/mips/libcapi10.so"
+        #define CAPI20_LIB_DEFAULT "/opt/cprocsp/lib/mips/libcapi20.so"
     #endif // byte order
 #elif defined( __arm__ )
-    #define CAPI10_LIB "/opt/cprocsp/lib/arm/libcapi10.so"
-    #define CAPI20_LIB "/opt/cprocsp/lib/arm/libcapi20.so"
+    #define CAPI10_LIB_DEFAULT "/opt/cprocsp/lib/arm/libcapi10.so"
+    #define CAPI20_LIB_DEFAULT "/opt/cprocsp/lib/arm/libcapi20.so"
 #elif defined( __aarch64__ ) // archs
-    #define CAPI10_LIB "/opt/cprocsp/lib/aarch64/libcapi10.so"
-    #define CAPI20_LIB "/opt/cprocsp/lib/aarch64/libcapi20.so"
+    #define CAPI10_LIB_DEFAULT "/opt/cprocsp/lib/aarch64/libcapi10.so"
+    #define CAPI20_LIB_DEFAULT "/opt/cprocsp/lib/aarch64/libcapi20.so"
 #elif defined( __i386__ ) // archs
-    #define CAPI10_LIB "/opt/cprocsp/lib/ia32/libcapi10.so"
-    #define CAPI20_LIB "/opt/cprocsp/lib/ia32/libcapi20.so"
+    #define CAPI10_LIB_DEFAULT "/opt/cprocsp/lib/ia32/libcapi10.so"
+    #define CAPI20_LIB_DEFAULT "/opt/cprocsp/lib/ia32/libcapi20.so"
 #else // archs
-#define CAPI10_LIB "/opt/cprocsp/lib/amd64/libcapi10.so"
-#define CAPI20_LIB "/opt/cprocsp/lib/amd64/libcapi20.so"
+#define CAPI10_LIB_DEFAULT "/opt/cprocsp/lib/amd64/libcapi10.so"
+#define CAPI20_LIB_DEFAULT "/opt/cprocsp/lib/amd64/libcapi20.so"
 #endif // archs
 #endif // _WIN32 or __APPLE__ or LINUX
 
-#if defined( __has_attribute )
+// CAPI10_LIB and CAPI20_LIB can be predefined (each on its own) to load other (e.g. mock) libraries
+#ifndef CAPI10_LIB
+#define CAPI10_LIB CAPI10_LIB_DEFAULT
+#endif
+#ifndef CAPI20_LIB
+#define CAPI20_LIB CAPI20_LIB_DEFAULT
+#endif
+
+#if defined( __clang__ )
 #define NOCFI __attribute__((no_sanitize("cfi-icall")))
 #else
 #define NOCFI
@@ -729,30 +2652,45 @@ extern "C" {
 
 extern "C" {
 
+// libraries are loaded once with every symbol bound up front (RTLD_NOW)
+static void * capi10x = NULL;
+static void * capi20x = NULL;
+static std::once_flag capix_once;
+
+static void capix_load()
+{
+    capi10x = dlopen( CAPI10_LIB, RTLD_NOW );
+    capi20x = dlopen( CAPI20_LIB, RTLD_NOW );
+}
+
 static void * get_capi10x( LPCSTR name )
 {
-    static void * capi10 = (void *)(uintptr_t)-1;
-    if( capi10 == (void *)(uintptr_t)-1 )
-        capi10 = dlopen( CAPI10_LIB, RTLD_LAZY );
-    return capi10 ? dlsym( capi10, name ) : NULL;
+    std::call_once( capix_once, capix_load );
+    return capi10x ? dlsym( capi10x, name ) : NULL;
 }
 
 static void * get_capi20x( LPCSTR name )
 {
-    static void * capi20 = (void *)(uintptr_t)-1;
-    if( capi20 == (void *)(uintptr_t)-1 )
-        capi20 = dlopen( CAPI20_LIB, RTLD_LAZY );
-    return capi20 ? dlsym( capi20, name ) : NULL;
+    std::call_once( capix_once, capix_load );
+    return capi20x ? dlsym( capi20x, name ) : NULL;
 }
 
+// each symbol is looked up once and published atomically (NULL: not resolved yet)
+#define CAPIX_BIND( name, lib ) \
+    static std::atomic<void *> capix_bound( NULL ); \
+    t_##name capix = (t_##name)capix_bound.load( std::memory_order_acquire ); \
+    if( !capix ) \
+    { \
+        capix = (t_##name)lib( #name ); \
+        capix_bound.store( (void *)capix, std::memory_order_release ); \
+    }
+
 #define DECLARE_CAPI10X_FUNCTION( rettype, name, args, callargs, retfalse ) \
 typedef rettype ( WINAPI * t_##name ) args; \
 rettype WINAPI name args \
 { \
     rettype result; \
-    static t_##name capix = NULL; \
-    if( !capix ) \
-        *(void **)&capix = get_capi10x( #name ); \
+    CAPIX_BIND( name, get_capi10x ) \
     if( !capix ) \
         return retfalse; \
     [&]()NOCFI{ result = capix callargs; }(); \
@@ -764,9 +2702,7 @@ typedef rettype ( WINAPI * t_##name ) args; \
 rettype WINAPI name args \
 { \
     rettype result; \
-    static t_##name capix = NULL; \
-    if( !capix ) \
-        *(void **)&capix = get_capi20x( #name ); \
+    CAPIX_BIND( name, get_capi20x ) \
     if( !capix ) \
         return retfalse; \
     [&]()NOCFI{ result = capix callargs; }(); \
@@ -777,9 +2713,7 @@ rettype WINAPI name args \
 typedef void ( WINAPI * t_##name ) args; \
 void WINAPI name args \
 { \
-    static t_##name capix = NULL; \
-    if( !capix ) \
-        *(void **)&capix = get_capi20x( #name ); \
+    CAPIX_BIND( name, get_capi20x ) \
     if( !capix ) \
         return; \
     [&]()NOCFI{ capix callargs; }(); \
@@ -877,6 +2811,10 @@ DECLARE_CAPI20X_FUNCTION( PCCERT_CONTEXT, CertGetIssuerCertificateFromStore,
     ( HCERTSTORE hCertStore, PCCERT_CONTEXT pSubjectContext, PCCERT_CONTEXT pPrevIssuerContext, DWORD * pdwFlags ),
     ( hCertStore, pSubjectContext, pPrevIssuerContext, pdwFlags ), NULL )
 
+DECLARE_CAPI20X_FUNCTION( BOOL, CertAddEncodedCertificateToStore,
+    ( HCERTSTORE hCertStore, DWORD dwCertEncodingType, const BYTE * pbCertEncoded, DWORD cbCertEncoded, DWORD dwAddDisposition, PCCERT_CONTEXT * ppCertContext ),
+    ( hCertStore, dwCertEncodingType, pbCertEncoded, cbCertEncoded, dwAddDisposition, ppCertContext ), FALSE )
+
 DECLARE_CAPI20X_FUNCTION( BOOL, CertGetCertificateChain,
     ( HCERTCHAINENGINE hChainEngine, PCCERT_CONTEXT pCertContext, LPFILETIME pTime, HCERTSTORE hAdditionalStore, PCERT_CHAIN_PARA pChainPara, DWORD dwFlags, LPVOID pvReserved, PCCERT_CHAIN_CONTEXT * ppChainContext ),
     ( hChainEngine, pCertContext, pTime, hAdditionalStore, pChainPara, dwFlags, pvReserved, ppChainContext ), FALSE )